@@ -0,0 +1,124 @@
+/*
+ * arena.c
+ * Copyright (c) 2020 Sergei Kosivchenko <archichief@gmail.com>
+ *
+ * smart-snmp is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * smart-snmp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <memory.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGNMENT _Alignof(max_align_t)
+
+struct arena_block {
+    arena_block_t *next;                        // next block in chain
+    size_t size;                                // size of data
+    size_t used;                                // bytes already given away
+    _Alignas(max_align_t) uint8_t data[];
+};
+
+static inline size_t align_size(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+}
+
+static arena_block_t *create_block(size_t size) {
+    arena_block_t *block;
+
+    if (NULL == (block = malloc(sizeof(*block) + size))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+
+    return block;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    arena_block_t *block = arena->current, *next;
+    size_t block_size = arena->block_size ? arena->block_size : SNMP_ARENA_BLOCK_SIZE;
+    void *result;
+
+    size = align_size(size ? size : 1);
+
+    // walk over blocks left from previous requests and reuse them, they were marked as empty by arena_reset()
+    while (NULL != block && block->size - block->used < size) {
+        if (NULL == (next = block->next)) break;
+
+        next->used = 0;
+        block = next;
+    }
+
+    if (NULL == block || block->size - block->used < size) {
+        if (NULL == (next = create_block(size > block_size ? size : block_size))) return NULL;
+
+        if (NULL == block) {
+            arena->head = next;
+        } else {
+            next->next = block->next;
+            block->next = next;
+        }
+
+        block = next;
+    }
+
+    arena->current = block;
+
+    result = block->data + block->used;
+    block->used += size;
+
+    return result;
+}
+
+void *arena_calloc(arena_t *arena, size_t size) {
+    void *result;
+
+    if (NULL != (result = arena_alloc(arena, size))) memset(result, 0, size);
+
+    return result;
+}
+
+void *arena_memdup(arena_t *arena, const void *data, size_t size) {
+    void *result;
+
+    if (NULL != (result = arena_alloc(arena, size))) memmove(result, data, size);
+
+    return result;
+}
+
+void arena_reset(arena_t *arena) {
+    // only first block is marked as empty, others will be emptied lazily when arena_alloc() step into them
+    if (NULL != arena->head) arena->head->used = 0;
+
+    arena->current = arena->head;
+}
+
+void arena_free(arena_t *arena) {
+    arena_block_t *block = arena->head, *next;
+
+    while (NULL != block) {
+        next = block->next;
+        free(block);
+        block = next;
+    }
+
+    arena->head = NULL;
+    arena->current = NULL;
+}
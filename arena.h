@@ -0,0 +1,48 @@
+/*
+ * arena.h
+ * Copyright (c) 2020 Sergei Kosivchenko <archichief@gmail.com>
+ *
+ * smart-snmp is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * smart-snmp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SNMP_ARENA_H
+#define SNMP_ARENA_H
+
+#include <stdlib.h>
+
+#ifndef SNMP_ARENA_BLOCK_SIZE
+#define SNMP_ARENA_BLOCK_SIZE (16 * 1024)
+#endif
+
+typedef struct arena_block arena_block_t;
+
+/*
+ * Bump allocator used to back all memory needed to process single request. Memory is never released piece by piece,
+ * whole arena is reset at once when request is processed. Blocks are kept between resets, so after warm up no calls
+ * to malloc are performed. Zero initialized arena is valid and uses SNMP_ARENA_BLOCK_SIZE blocks.
+ */
+typedef struct arena {
+    arena_block_t *head;                        // first block in chain
+    arena_block_t *current;                     // block allocations are made from
+    size_t block_size;                          // default size of newly allocated blocks
+} arena_t;
+
+void *arena_alloc(arena_t *arena, size_t size);
+void *arena_calloc(arena_t *arena, size_t size);
+void *arena_memdup(arena_t *arena, const void *data, size_t size);
+
+void arena_reset(arena_t *arena);
+void arena_free(arena_t *arena);
+
+#endif //SNMP_ARENA_H
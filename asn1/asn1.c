@@ -23,72 +23,69 @@
 #include "asn1.h"
 #include "../ber.h"
 
-asn1_node_t *create_asn1_node(asn1_node_t *root, int type, const void *data, size_t size, bool is_allocated) {
-    asn1_node_t *result;
+#define ASN1_ITEMS_INITIAL_CAP 4
+
+static int append_item(arena_t *arena, asn1_node_t *root, asn1_node_t *node) {
     asn1_node_t **items;
+    size_t cap;
 
-    if (NULL == (result = calloc(1, sizeof(*result)))) {
-        errno = ENOMEM;
-        return NULL;
+    if (root->content.c.items_num == root->content.c.items_cap) {
+        cap = root->content.c.items_cap ? root->content.c.items_cap * 2 : ASN1_ITEMS_INITIAL_CAP;
+
+        // arena can't grow allocation in place, so old array is just left in arena until it will be reset
+        if (NULL == (items = arena_alloc(arena, cap * sizeof(*items)))) {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        if (root->content.c.items_num)
+            memmove(items, root->content.c.items, root->content.c.items_num * sizeof(*items));
+
+        root->content.c.items = items;
+        root->content.c.items_cap = cap;
     }
 
-    if (NULL != root) {
-        if (ber_is_constructed_type(root->type)) {
-            items = realloc(root->content.c.items, (root->content.c.items_num + 1) * sizeof(*root->content.c.items));
+    root->content.c.items[root->content.c.items_num++] = node;
+    node->root = root;
+
+    return 0;
+}
+
+asn1_node_t *create_asn1_node(arena_t *arena, asn1_node_t *root, int type, const void *data, size_t size) {
+    asn1_node_t *result;
 
-            if (NULL == items) {
-                errno = ENOMEM;
-                goto fail;
-            }
+    if (NULL != root && !ber_is_constructed_type(root->type)) {
+        errno = EINVAL;
+        return NULL;
+    }
 
-            items[root->content.c.items_num++] = result;
-            root->content.c.items = items;
-        } else {
-            errno = EINVAL;
-            goto fail;
-        }
+    if (NULL == (result = arena_calloc(arena, sizeof(*result)))) {
+        errno = ENOMEM;
+        return NULL;
     }
 
     if (!ber_is_constructed_type(type)) {
         result->content.p.size = size;
         result->content.p.data = data;
-        result->content.p.is_allocated = is_allocated;
     }
 
     result->type = type;
-    result->root = root;
 
-    return result;
+    if (NULL != root && 0 != append_item(arena, root, result)) return NULL;
 
-fail:
-    free(result);
-    return NULL;
+    return result;
 }
 
-int add_asn1_node(asn1_node_t *root, asn1_node_t *node) {
-    asn1_node_t **items;
-
+int add_asn1_node(arena_t *arena, asn1_node_t *root, asn1_node_t *node) {
     if (NULL == root || !ber_is_constructed_type(root->type) || NULL == node) {
         errno = EINVAL;
         return -1;
     }
 
-    items = realloc(root->content.c.items, (root->content.c.items_num + 1) * sizeof(*root->content.c.items));
-
-    if (NULL == items) {
-        errno = ENOMEM;
-        return -1;
-    }
-
-    items[root->content.c.items_num++] = node;
-    node->root = root;
-
-    root->content.c.items = items;
-
-    return 0;
+    return append_item(arena, root, node);
 }
 
-asn1_node_t *copy_primitive_asn1_node(const asn1_node_t *base) {
+asn1_node_t *copy_primitive_asn1_node(arena_t *arena, const asn1_node_t *base) {
     asn1_node_t *result;
     size_t data_size = base->content.p.size;
 
@@ -97,7 +94,7 @@ asn1_node_t *copy_primitive_asn1_node(const asn1_node_t *base) {
         return NULL;
     }
 
-    if (NULL == (result = calloc(1, sizeof(*result)))) {
+    if (NULL == (result = arena_calloc(arena, sizeof(*result)))) {
         errno = ENOMEM;
         return NULL;
     }
@@ -105,15 +102,11 @@ asn1_node_t *copy_primitive_asn1_node(const asn1_node_t *base) {
     result->type = base->type;
     result->content.p.size = data_size;
 
-    if (NULL == (result->content.p.data = malloc(data_size))) {
-        free(result);
+    if (NULL == (result->content.p.data = arena_memdup(arena, base->content.p.data, data_size))) {
         errno = ENOMEM;
         return NULL;
     }
 
-    result->content.p.is_allocated = true;
-    memmove((void *)result->content.p.data, base->content.p.data, data_size);
-
     return result;
 }
 
@@ -134,21 +127,3 @@ int traverse_asn1_tree(asn1_node_t *root, void *user_data, asn1_tree_traverse_cl
 
     return 0;
 }
-
-void release_asn1_tree(asn1_node_t *root) {
-    size_t i;
-    asn1_node_t *node;
-
-    if (ber_is_constructed_type(root->type)) {
-        for (i = 0; i < root->content.c.items_num; ++i) {
-            node = root->content.c.items[i];
-            release_asn1_tree(node);
-
-            free(node);
-        }
-
-        free(root->content.c.items);
-    } else if (root->content.p.is_allocated) {
-        free((void *)root->content.p.data);
-    }
-}
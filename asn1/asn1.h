@@ -22,6 +22,8 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
+#include "../arena.h"
+
 typedef struct asn1_node asn1_node_t;
 typedef int (*asn1_tree_traverse_clbk_t)(void *user_data, asn1_node_t *node);
 
@@ -33,24 +35,26 @@ struct asn1_node {
     union {
         struct {
             size_t items_num;                   // number of items in constructed type
+            size_t items_cap;                   // number of items what can be stored without reallocation
             asn1_node_t **items;           // items
         } c;                                    // constructed type
         struct {
             size_t size;                        // size of data in bytes
             const void *data;                   // pointer to data
-            bool is_allocated;                  // data was allocated on heap
         } p;                                    // primitive data
     } content;                                  // content of node
 };
 
 int traverse_asn1_tree(asn1_node_t *root, void *user_data, asn1_tree_traverse_clbk_t clbk);
 
-asn1_node_t *create_asn1_node(asn1_node_t *root, int type, const void *data, size_t size, bool is_allocated);
-
-int add_asn1_node(asn1_node_t *root, asn1_node_t *node);
+/*
+ * All nodes, items arrays and copied data are allocated from arena, so tree is released all at once by resetting
+ * the arena.
+ */
+asn1_node_t *create_asn1_node(arena_t *arena, asn1_node_t *root, int type, const void *data, size_t size);
 
-asn1_node_t *copy_primitive_asn1_node(const asn1_node_t *base);
+int add_asn1_node(arena_t *arena, asn1_node_t *root, asn1_node_t *node);
 
-void release_asn1_tree(asn1_node_t *root);
+asn1_node_t *copy_primitive_asn1_node(arena_t *arena, const asn1_node_t *base);
 
 #endif //SNMP_ASN1_H
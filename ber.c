@@ -23,67 +23,76 @@
 #include "ber.h"
 #include "utilities.h"
 
-typedef struct encoding_data {
-    uint8_t *buffer;
-    size_t shift;
-} encoding_data_t;
+// continuation bits of eight octets, arcs below 128 are single octets without it
+#define BER_CONTINUATION_BITS 0x8080808080808080ULL
 
+// returns number of leading octets without continuation bit among eight ones, so arcs are found word at a time
+static inline size_t count_short_arcs(const uint8_t *data) {
+    uint64_t bits;
 
-static int encode_node(void *user_data, asn1_node_t *node) {
-    encoding_data_t *ed = (encoding_data_t *)user_data;
-    uint8_t *buf = ed->buffer;
-    ssize_t bytes_wrote;
-    size_t shift = ed->shift;
-    size_t content_length;
+    memcpy(&bits, data, sizeof(bits));
+    if (0 == (bits &= BER_CONTINUATION_BITS)) return 8;
 
-    buf[shift++] = (uint8_t)node->type;
-
-    if (node->full_size < 127)
-        content_length = node->full_size - 2; // TAG + 1 byte of content length
-    else if (node->full_size < 255)
-        content_length = node->full_size - 3; // TAG + 0x81 + 1 byte of content length
-    else if (node->full_size < 512)
-        content_length = node->full_size - 4; // TAG + 0x82 + 2 bytes of content length
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return (size_t) __builtin_ctzll(bits) / 8;
+#else
+    return (size_t) __builtin_clzll(bits) / 8;
+#endif
+}
 
-    if ((bytes_wrote = ber_encode_length(&content_length, buf + shift)) < 0)
+static int prepend_data(const uint8_t *start, uint8_t **pos, const void *data, size_t size) {
+    if ((size_t)(*pos - start) < size) {
+        errno = ENOBUFS;
         return -1;
-    shift += (size_t)bytes_wrote;
-
-    if (!ber_is_constructed_type(node->type)) {
-        memmove(buf + shift, node->content.p.data, node->content.p.size);
-        shift += node->content.p.size;
     }
 
-    ed->shift = shift;
+    *pos -= size;
+    memmove(*pos, data, size);
 
     return 0;
 }
 
-static int set_zero_full_size(__attribute__((unused)) void *_, asn1_node_t *node) {
-    node->full_size = 0;
-    return 0;
+static int prepend_length(const uint8_t *start, uint8_t **pos, size_t length) {
+    uint8_t octets[sizeof(length) + 1];
+    uint8_t *tmp = octets + sizeof(octets);
+
+    // long form is written from the least significant octet, number of octets goes last
+    if (length > 127) {
+        while (length) {
+            *--tmp = (uint8_t)(length & 0xFF);
+            length >>= 8;
+        }
+
+        length = 0x80 | (octets + sizeof(octets) - tmp);
+    }
+
+    *--tmp = (uint8_t)length;
+
+    return prepend_data(start, pos, tmp, octets + sizeof(octets) - tmp);
 }
 
-static size_t calc_full_sizes(asn1_node_t *node) {
+static int encode_node(const uint8_t *start, uint8_t **pos, asn1_node_t *node) {
+    uint8_t *end = *pos, tag = (uint8_t)node->type;
     size_t i;
-    size_t full_size = 0;
 
     if (ber_is_constructed_type(node->type)) {
-        for (i = 0; i < node->content.c.items_num; i++) {
-            full_size += calc_full_sizes(node->content.c.items[i]);
+        for (i = node->content.c.items_num; i > 0; i--) {
+            if (0 != encode_node(start, pos, node->content.c.items[i - 1])) return -1;
         }
-    } else {
-        full_size = node->content.p.size;
+    } else if (0 != prepend_data(start, pos, node->content.p.data, node->content.p.size)) {
+        return -1;
     }
 
-    full_size = 1 + ber_calc_encoded_length_len(&full_size) + full_size;
-    node->full_size = full_size;
+    if (0 != prepend_length(start, pos, (size_t)(end - *pos)) || 0 != prepend_data(start, pos, &tag, sizeof(tag)))
+        return -1;
 
-    return full_size;
+    node->full_size = end - *pos;
+
+    return 0;
 }
 
-ssize_t ber_decode_asn1_tree(const uint8_t *data, size_t data_size, asn1_node_t *root) {
-    asn1_node_t **elems = NULL, *node = NULL;
+ssize_t ber_decode_asn1_tree(arena_t *arena, const uint8_t *data, size_t data_size, asn1_node_t *root) {
+    asn1_node_t *node = NULL;
     size_t content_size = 0;
     ssize_t bytes_read = 0;
     const uint8_t *tmp_data = data;
@@ -97,44 +106,50 @@ ssize_t ber_decode_asn1_tree(const uint8_t *data, size_t data_size, asn1_node_t
 
     memset(root, 0, sizeof(*root));
 
+    // at least TAG and one byte of length
+    if (data_size < 2) {
+        errno = EINVAL;
+        return -1;
+    }
+
     root->type = *tmp_data++;
 
+    // length octets of long form must be inside of data too
+    if ((*tmp_data & 0x80) && data_size - 1 < 1 + (size_t)(*tmp_data & 0x7F)) {
+        errno = EINVAL;
+        return -1;
+    }
+
     if ((bytes_read = ber_decode_length(tmp_data, &content_size)) < 1) {
         errno = EINVAL;
         return -1;
     }
 
+    // content can't be outside of data, sizes aren't summed since length can be close to SIZE_MAX
+    if (content_size > data_size - 1 - (size_t) bytes_read) {
+        errno = EINVAL;
+        return -1;
+    }
+
     tmp_data += bytes_read;
     root->full_size = 1 + bytes_read + content_size; // +1 byte for TAG
 
     if (ber_is_constructed_type(root->type)) {
-        elems = root->content.c.items;
         while (content_size > 0) {
-            elems = realloc(elems, (root->content.c.items_num + 1) * sizeof(*elems));
-
-            if(NULL == elems) {
+            if (NULL == (node = arena_alloc(arena, sizeof(*node)))) {
+                errno = ENOMEM;
                 return -1;
             }
 
-            node = malloc(sizeof(*node));
-
-            elems[root->content.c.items_num] = node;
-
-            if ((bytes_read = ber_decode_asn1_tree(tmp_data, content_size, node)) < 0) {
+            if ((bytes_read = ber_decode_asn1_tree(arena, tmp_data, content_size, node)) < 0 ||
+                0 != add_asn1_node(arena, root, node)) {
                 return -1;
             }
 
             tmp_data += bytes_read;
             content_size -= bytes_read;
-
-            node->root = root;
-            root->content.c.items_num++;
         }
-
-        root->content.c.items = elems;
-
     } else {
-        root->content.p.is_allocated = false;
         root->content.p.size = content_size;
         root->content.p.data = tmp_data;
     }
@@ -142,55 +157,144 @@ ssize_t ber_decode_asn1_tree(const uint8_t *data, size_t data_size, asn1_node_t
     return tmp_data - data + content_size;
 }
 
-ssize_t ber_encode_asn1_tree(asn1_node_t *root, uint8_t **buffer) {
-    encoding_data_t ed;
+ssize_t ber_encode_asn1_tree(asn1_node_t *root, uint8_t *buffer, size_t size, uint8_t **result) {
+    uint8_t *pos = buffer + size;
 
-    traverse_asn1_tree(root, NULL, set_zero_full_size);
+    if (0 != encode_node(buffer, &pos, root)) return -1;
 
-    calc_full_sizes(root);
+    *result = pos;
 
-    *buffer = malloc(root->full_size);
-    if (NULL == *buffer) {
-        errno = ENOMEM;
+    return buffer + size - pos;
+}
+
+static inline ber_cursor_t tlv_content(const ber_tlv_t *tlv) {
+    ber_cursor_t cursor = { .pos = tlv->data, .end = tlv->data + tlv->size };
+    return cursor;
+}
+
+static inline int read_typed_tlv(ber_cursor_t *cursor, int type, ber_tlv_t *tlv) {
+    if (0 != ber_read_tlv(cursor, tlv) || type != tlv->type) {
+        errno = EINVAL;
         return -1;
     }
 
-    ed.buffer = *buffer;
-    ed.shift = 0;
+    return 0;
+}
+
+int ber_read_tlv(ber_cursor_t *cursor, ber_tlv_t *tlv) {
+    const uint8_t *pos = cursor->pos;
+    size_t size = 0;
+    ssize_t bytes_read;
+
+    // at least TAG and one byte of length
+    if (cursor->end - pos < 2) goto fail;
+
+    tlv->type = *pos++;
 
-    if (0 != traverse_asn1_tree(root, &ed, encode_node)) return -1;
+    // length octets of long form must be inside of data too
+    if ((*pos & 0x80) && (size_t)(cursor->end - pos) < 1 + (size_t)(*pos & 0x7F)) goto fail;
+
+    if ((bytes_read = ber_decode_length(pos, &size)) < 1) goto fail;
+    pos += bytes_read;
+
+    if (size > (size_t)(cursor->end - pos)) goto fail;
+
+    tlv->data = pos;
+    tlv->size = size;
+    cursor->pos = pos + size;
+
+    return 0;
 
-    return ed.shift;
+    fail:
+    errno = EINVAL;
+    return -1;
+}
+
+int ber_parse_snmp_message(const uint8_t *data, size_t size, snmp_message_t *msg) {
+    ber_cursor_t cursor = { .pos = data, .end = data + size };
+    ber_tlv_t tlv, pdu, varbinds;
+
+    // message is SEQUENCE what occupies whole datagram
+    if (0 != read_typed_tlv(&cursor, OBJECT_TYPE_SEQUENCE, &tlv) || cursor.pos != cursor.end) goto fail;
+    cursor = tlv_content(&tlv);
+
+    if (0 != read_typed_tlv(&cursor, OBJECT_TYPE_INTEGER, &msg->version) ||
+        0 != read_typed_tlv(&cursor, OBJECT_TYPE_OCTET_STRING, &msg->community) ||
+        0 != ber_read_tlv(&cursor, &pdu) || cursor.pos != cursor.end) {
+        goto fail;
+    }
+
+    // PDUs are constructed types of context-specific class
+    if (0xA0 != (pdu.type & 0xE0)) goto fail;
+
+    msg->pdu_type = pdu.type;
+    cursor = tlv_content(&pdu);
+
+    if (0 != read_typed_tlv(&cursor, OBJECT_TYPE_INTEGER, &msg->request_id) ||
+        0 != read_typed_tlv(&cursor, OBJECT_TYPE_INTEGER, &msg->error_status) ||
+        0 != read_typed_tlv(&cursor, OBJECT_TYPE_INTEGER, &msg->error_index) ||
+        0 != read_typed_tlv(&cursor, OBJECT_TYPE_SEQUENCE, &varbinds) || cursor.pos != cursor.end) {
+        goto fail;
+    }
+
+    msg->varbinds = tlv_content(&varbinds);
+
+    return 0;
+
+    fail:
+    errno = EINVAL;
+    return -1;
+}
+
+int ber_next_varbind(ber_cursor_t *varbinds, ber_tlv_t *name, ber_tlv_t *value) {
+    ber_cursor_t cursor;
+    ber_tlv_t varbind;
+
+    if (varbinds->pos == varbinds->end) return 0;
+
+    // varbind must be SEQUENCE with OID and primitive value
+    if (0 != read_typed_tlv(varbinds, OBJECT_TYPE_SEQUENCE, &varbind)) return -1;
+    cursor = tlv_content(&varbind);
+
+    if (0 != read_typed_tlv(&cursor, OBJECT_TYPE_OID, name) || 0 == name->size ||
+        0 != ber_read_tlv(&cursor, value) || ber_is_constructed_type(value->type) || cursor.pos != cursor.end) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 1;
 }
 
 ssize_t ber_decode_oid(const uint8_t *data, size_t size, oid_t *res) {
-    int *tmp_val = res->subids;
-    const uint8_t *tmp_data;
-    memset(res, 0, sizeof(*res));
-
-    tmp_data = data;
-
-    *tmp_val++ = *tmp_data / 40;
-    *tmp_val++ = *tmp_data % 40;
-    size--;
-    tmp_data++;
-
-    while (size) {
-        *tmp_val = 0;
-        while (size--) {
-            *tmp_val = (*tmp_val << 7) + (*tmp_data & 0x7F);
-            if (*tmp_data & 0x80) {
-                tmp_data++;
-            } else {
-                tmp_data++;
-                break;
-            }
+    size_t i = 0, n;
+
+    // the last octet ends an arc, so no arc runs beyond data
+    if (!size || (data[size - 1] & 0x80)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    while (i < size) {
+        if (size - i >= 8 && 0 != (n = count_short_arcs(data + i))) {
+            i += n;
+            continue;
         }
-        tmp_val++;
+
+        for (n = 1; data[i + n - 1] & 0x80; n++);
+
+        // arcs must be encoded in the minimal number of octets and fit into 32 bits, otherwise comparison is broken
+        if (0x80 == data[i] || n > 5 || (5 == n && (data[i] & 0x7F) > 0x0F)) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        i += n;
     }
 
-    res->subids_cnt = tmp_val - res->subids;
-    return tmp_data - data;
+    res->data = data;
+    res->len = size;
+
+    return (ssize_t) size;
 }
 
 ssize_t ber_decode_octet_string(const uint8_t *data, size_t size, char **res) {
@@ -209,19 +313,24 @@ ssize_t ber_decode_octet_string(const uint8_t *data, size_t size, char **res) {
 }
 
 ssize_t ber_decode_integer(const uint8_t *data, size_t size, int *res) {
-    const uint8_t *tmp_data = data;
-    *res = 0;
+    uint32_t val;
+    size_t i;
 
     if (!size || size > sizeof(*res)) {
         errno = EINVAL;
         return -1;
     }
 
-    while (size--) {
-        *res = (*res << 8) + *tmp_data++;
+    // content is two's complement, so the first octet is sign extended
+    val = (data[0] & 0x80) ? UINT32_MAX : 0;
+
+    for (i = 0; i < size; i++) {
+        val = (val << 8) | data[i];
     }
 
-    return tmp_data - data;
+    *res = (int) val;
+
+    return (ssize_t) size;
 }
 
 ssize_t ber_decode_length(const uint8_t *data, size_t *res) {
@@ -249,12 +358,15 @@ ssize_t ber_decode_length(const uint8_t *data, size_t *res) {
      */
     if (*tmp_data & 0x80) {
         // we can't handle so big values or empty lengths. probably where was an error in packet transmission
-        if ((bytes_read = *tmp_data++ & 0x7F) > sizeof(*res) || bytes_read == 0) {
+        if ((bytes_read = *tmp_data++ & 0x7F) > (ssize_t) sizeof(*res) || bytes_read == 0) {
             errno = EINVAL;
             return -1;
         }
 
-        tmp_data += ber_decode_integer(tmp_data, (size_t)bytes_read, (int *) res);
+        // length is unsigned, unlike INTEGER
+        for (*res = 0; bytes_read--;) {
+            *res = (*res << 8) | *tmp_data++;
+        }
     } else {
         *res = (size_t)(*tmp_data++) & 0x7F;
     }
@@ -263,35 +375,86 @@ ssize_t ber_decode_length(const uint8_t *data, size_t *res) {
 }
 
 ssize_t ber_encode_oid(const oid_t *data, uint8_t *res) {
-    size_t i;
-    size_t len;
+    memmove(res, data->data, data->len);
+    return (ssize_t) data->len;
+}
+
+// every octet carries 7 bits of arc, zero takes one octet too
+static inline size_t calc_subid_len(uint32_t subid) {
+    return (size_t) (38 - __builtin_clz(subid | 1)) / 7;
+}
+
+ssize_t ber_encode_arcs(const uint32_t *arcs, size_t arcs_cnt, uint8_t *res) {
+    size_t i, len;
     uint8_t *res_tmp = res;
 
-    *res_tmp++ = (uint8_t)(data->subids[0] * 40 + data->subids[1]);
+    for (i = 0; i < arcs_cnt; i++) {
+        if (arcs[i] < 0x80) {
+            *res_tmp++ = (uint8_t) arcs[i];
+            continue;
+        }
 
-    for (i = 2; i < data->subids_cnt; i++) {
-        if (data->subids[i] >= (1 << 28))
-            len = 5;
-        else if (data->subids[i] >= (1 << 21))
-            len = 4;
-        else if (data->subids[i] >= (1 << 14))
-            len = 3;
-        else if (data->subids[i] >= (1 << 7))
-            len = 2;
-        else
-            len = 1;
+        len = calc_subid_len(arcs[i]);
 
         while (len--) {
-            if (len)
-                *res_tmp++ = ((data->subids[i] >> (7 * len)) & 0x7F) | 0x80;
-            else
-                *res_tmp++ = (data->subids[i] >> (7 * len)) & 0x7F;
+            *res_tmp++ = (uint8_t)(((arcs[i] >> (7 * len)) & 0x7F) | (len ? 0x80 : 0));
         }
     }
 
     return res_tmp - res;
 }
 
+ssize_t ber_encode_subids(const uint32_t *subids, size_t subids_cnt, uint8_t *res) {
+    uint32_t subid;
+    ssize_t len;
+
+    if (subids_cnt < 2 || subids[0] > 2 || (subids[0] < 2 && subids[1] >= 40) || subids[1] > UINT32_MAX - 80) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // first two arcs share the same subidentifier
+    subid = subids[0] * 40 + subids[1];
+    len = ber_encode_arcs(&subid, 1, res);
+
+    return len + ber_encode_arcs(subids + 2, subids_cnt - 2, res + len);
+}
+
+size_t ber_decode_arcs(const uint8_t *data, size_t size, uint32_t *arcs, size_t arcs_max) {
+    size_t i = 0, j, n, cnt = 0;
+    uint32_t arc;
+
+    while (i < size) {
+        // single octet arcs are copied as they are, all eight at once while they fit, the rest is overwritten later
+        if (size - i >= 8 && 0 != (n = count_short_arcs(data + i))) {
+            if (cnt + 8 <= arcs_max) {
+                for (j = 0; j < 8; j++) arcs[cnt + j] = data[i + j];
+            } else {
+                for (j = 0; j < n; j++) {
+                    if (cnt + j < arcs_max) arcs[cnt + j] = data[i + j];
+                }
+            }
+
+            cnt += n;
+            i += n;
+            continue;
+        }
+
+        for (arc = 0; i < size && (data[i] & 0x80); i++) {
+            arc = (arc << 7) | (data[i] & 0x7F);
+        }
+
+        // unterminated arc isn't counted
+        if (i == size) break;
+
+        if (cnt < arcs_max) arcs[cnt] = (arc << 7) | data[i];
+        cnt++;
+        i++;
+    }
+
+    return cnt;
+}
+
 ssize_t ber_encode_octet_string(const char *data, uint8_t *res) {
     size_t size = strlen(data) * sizeof(*data);
     memmove(res, data, size);
@@ -299,15 +462,36 @@ ssize_t ber_encode_octet_string(const char *data, uint8_t *res) {
 }
 
 ssize_t ber_encode_integer(const int *data, uint8_t *res) {
-    const int val = *data;
-    uint8_t *res_tmp = res;
-    size_t len = ber_calc_encoded_integer_len(data);
+    const uint32_t val = (uint32_t) *data;
+    size_t i, len = ber_calc_encoded_integer_len(data);
 
-    while (len--) {
-        *res_tmp++ = (uint8_t)((val >> (8 * len)) & 0xFF);
+    for (i = 0; i < len; i++) {
+        res[i] = (uint8_t) (val >> (8 * (len - 1 - i)));
     }
 
-    return res_tmp - res;
+    return (ssize_t) len;
+}
+
+ssize_t ber_encode_int64(const int64_t *data, uint8_t *res) {
+    const uint64_t val = (uint64_t) *data;
+    size_t i, len = ber_calc_encoded_int64_len(data);
+
+    for (i = 0; i < len; i++) {
+        res[i] = (uint8_t) (val >> (8 * (len - 1 - i)));
+    }
+
+    return (ssize_t) len;
+}
+
+ssize_t ber_encode_uint64(const uint64_t *data, uint8_t *res) {
+    size_t i, len = ber_calc_encoded_uint64_len(data);
+
+    // the ninth octet is the leading zero, shift by 64 bits is undefined
+    for (i = 0; i < len; i++) {
+        res[i] = len - 1 - i < sizeof(*data) ? (uint8_t) (*data >> (8 * (len - 1 - i))) : 0;
+    }
+
+    return (ssize_t) len;
 }
 
 ssize_t ber_encode_length(const size_t *data, uint8_t *res) {
@@ -327,41 +511,74 @@ ssize_t ber_encode_length(const size_t *data, uint8_t *res) {
     return res_tmp - res;
 }
 
-size_t ber_calc_encoded_oid_len(const oid_t *data) {
-    size_t i;
-    size_t len = 1;
-
-    for (i = 2; i < data->subids_cnt; ++i) {
-        if (data->subids[i] >= (1 << 28))
-            len += 5;
-        else if (data->subids[i] >= (1 << 21))
-            len += 4;
-        else if (data->subids[i] >= (1 << 14))
-            len += 3;
-        else if (data->subids[i] >= (1 << 7))
-            len += 2;
-        else
-            len += 1;
+size_t ber_calc_encoded_oid_len(const oid_t *data) { return data->len; }
+
+size_t ber_calc_encoded_arcs_len(const uint32_t *arcs, size_t arcs_cnt) {
+    size_t i, len = 0;
+
+    for (i = 0; i < arcs_cnt; i++) {
+        len += arcs[i] < 0x80 ? 1 : calc_subid_len(arcs[i]);
     }
 
     return len;
 }
 
+size_t ber_calc_encoded_subids_len(const uint32_t *subids, size_t subids_cnt) {
+    uint32_t subid;
+
+    // OID is invalid, ber_encode_subids() will report it
+    if (subids_cnt < 2) return 0;
+
+    subid = subids[0] * 40 + subids[1];
+
+    return ber_calc_encoded_arcs_len(&subid, 1) + ber_calc_encoded_arcs_len(subids + 2, subids_cnt - 2);
+}
+
+int oid_compare(const oid_t *a, const oid_t *b) {
+    int res = memcmp(a->data, b->data, a->len < b->len ? a->len : b->len);
+
+    // shorter OID is a prefix of longer one and goes first
+    return res ? res : (a->len > b->len) - (a->len < b->len);
+}
+
+bool oid_is_in_subtree(const oid_t *oid, const oid_t *subtree) {
+    // last octet of canonical encoding has no continuation bit, so prefix of encoding is prefix of arcs
+    return oid->len >= subtree->len && 0 == memcmp(oid->data, subtree->data, subtree->len);
+}
+
+uint32_t oid_hash(const oid_t *oid) {
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < oid->len; i++) {
+        hash = (hash ^ oid->data[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
 size_t ber_calc_encoded_octet_string_len(const char *data) { return strlen(data) * sizeof(char); }
 
 size_t ber_calc_encoded_integer_len(const int *data) {
-    if (*data & (0xFF << 24))
-        return 4;
-    else if (*data & (0xFF << 16))
-        return 3;
-    else if (*data & (0xFF << 8))
-        return 2;
-    else
-        return 1;
+    // negative value has as many significant bits as its complement, and one more bit is needed for sign
+    uint32_t val = (uint32_t) (*data < 0 ? ~*data : *data);
+
+    return val ? (size_t) (40 - __builtin_clz(val)) / 8 : 1;
+}
+
+size_t ber_calc_encoded_int64_len(const int64_t *data) {
+    uint64_t val = (uint64_t) (*data < 0 ? ~*data : *data);
+
+    return val ? (size_t) (72 - __builtin_clzll(val)) / 8 : 1;
+}
+
+size_t ber_calc_encoded_uint64_len(const uint64_t *data) {
+    return *data ? (size_t) (72 - __builtin_clzll(*data)) / 8 : 1;
 }
 
 size_t ber_calc_encoded_length_len(const size_t *data) {
+    // long form is number of octets followed by octets of unsigned length
     return (*data > 127)
-        ? ber_calc_encoded_integer_len((const int *) data) + 1
+        ? (sizeof(unsigned long) * 8 + 7 - (size_t) __builtin_clzl(*data)) / 8 + 1
         : 1;
 }
\ No newline at end of file
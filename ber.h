@@ -24,15 +24,17 @@
 #include <stdbool.h>
 #include <stdio.h>
 
+#include "arena.h"
 #include "asn1/asn1.h"
 
-#ifndef SNMP_OID_LEN
-#define SNMP_OID_LEN 40
-#endif
-
+/*
+ * OID is kept in its BER-encoded form: content octets of OBJECT IDENTIFIER without tag and length. Encoding is
+ * canonical, so OIDs are ordered lexicographically by oid_compare() without decoding arcs. Data is not owned by
+ * oid_t, it points to received packet, MIB storage or any other buffer what outlives it.
+ */
 typedef struct oid {
-    int32_t subids[SNMP_OID_LEN];
-    size_t subids_cnt;
+    size_t len;
+    const uint8_t *data;
 } oid_t;
 
 typedef enum object_type {
@@ -47,6 +49,7 @@ typedef enum object_type {
     OBJECT_TYPE_TIMETICKS         = 0x43,
     OBJECT_TYPE_OPAQUE            = 0x44,
     OBJECT_TYPE_NSAPADDRESS       = 0x45,
+    OBJECT_TYPE_COUNTER64         = 0x46,
 
     OBJECT_TYPE_NO_OBJECT         = 0x80,
     OBJECT_TYPE_NO_INSTANCE       = 0x81,
@@ -59,19 +62,68 @@ typedef enum request_type {
     REQUEST_TYPE_GETRESPONSE      = 0xA2,
     REQUEST_TYPE_SET              = 0xA3,
     REQUEST_TYPE_TRAP             = 0xA4,
+    REQUEST_TYPE_GETBULK          = 0xA5,
 } request_type_t;
 
+typedef enum error_status {
+    ERROR_STATUS_NO_ERROR         = 0,
+    ERROR_STATUS_TOO_BIG          = 1,
+    ERROR_STATUS_NO_SUCH_NAME     = 2,
+    ERROR_STATUS_BAD_VALUE        = 3,
+    ERROR_STATUS_READ_ONLY        = 4,
+    ERROR_STATUS_GEN_ERR          = 5,
+} error_status_t;
+
 typedef enum snmp_version {
     SNMP_VERSION_1                = 0,
     SNMP_VERSION_2C               = 1,
     SNMP_VERSION_3                = 3
 } snmp_version_t;
 
+// position inside of encoded data, never goes beyond end
+typedef struct ber_cursor {
+    const uint8_t *pos;                         // next byte to read
+    const uint8_t *end;                         // first byte after data
+} ber_cursor_t;
+
+// single element read by cursor, content points into encoded data
+typedef struct ber_tlv {
+    int type;                                   // element tag
+    const uint8_t *data;                        // content octets
+    size_t size;                                // number of content octets
+} ber_tlv_t;
+
+// SNMP message which PDU has request layout: request-id, error-status, error-index and varbind list
+typedef struct snmp_message {
+    ber_tlv_t version;
+    ber_tlv_t community;
+    int pdu_type;
+    ber_tlv_t request_id;
+    ber_tlv_t error_status;                     // non-repeaters for GetBulkRequest
+    ber_tlv_t error_index;                      // max-repetitions for GetBulkRequest
+    ber_cursor_t varbinds;                      // content of varbind list, not parsed yet
+} snmp_message_t;
+
 static inline bool ber_is_constructed_type(int type) { return (bool)(type & 0x20); }
 
-ssize_t ber_decode_asn1_tree(const uint8_t *data, size_t data_size, asn1_node_t *root);
-ssize_t ber_encode_asn1_tree(asn1_node_t *root, uint8_t **buffer);
+ssize_t ber_decode_asn1_tree(arena_t *arena, const uint8_t *data, size_t data_size, asn1_node_t *root);
+/*
+ * Encodes tree in single pass from the end of buffer to its beginning: content of every node is written first and its
+ * length and tag are prepended, so no sizes have to be calculated in advance. On success returns encoded size and
+ * stores pointer to the first encoded byte inside buffer in result. If tree doesn't fit fails with ENOBUFS.
+ */
+ssize_t ber_encode_asn1_tree(asn1_node_t *root, uint8_t *buffer, size_t size, uint8_t **result);
+
+/*
+ * Streaming parser. Message is validated only structurally and without any allocations, varbinds are yielded one by
+ * one by ber_next_varbind() as slices of parsed data. ber_next_varbind() returns 1 if varbind was read, 0 when list is
+ * over and -1 if it is malformed.
+ */
+int ber_read_tlv(ber_cursor_t *cursor, ber_tlv_t *tlv);
+int ber_parse_snmp_message(const uint8_t *data, size_t size, snmp_message_t *msg);
+int ber_next_varbind(ber_cursor_t *varbinds, ber_tlv_t *name, ber_tlv_t *value);
 
+// validates OID content and makes res to point to it
 ssize_t ber_decode_oid(const uint8_t *data, size_t size, oid_t *res);
 ssize_t ber_decode_octet_string(const uint8_t *data, size_t size, char **res);
 ssize_t ber_decode_integer(const uint8_t *data, size_t size, int *res);
@@ -83,8 +135,34 @@ ssize_t ber_encode_integer(const int *data, uint8_t *res);
 ssize_t ber_encode_length(const size_t *data, uint8_t *res);
 
 size_t ber_calc_encoded_oid_len(const oid_t *data);
+
+// encodes OID given by arcs, encoded data is the content of oid_t
+ssize_t ber_encode_subids(const uint32_t *subids, size_t subids_cnt, uint8_t *res);
+size_t ber_calc_encoded_subids_len(const uint32_t *subids, size_t subids_cnt);
+
+// encodes arcs as they are, without joining the first two, so result can be appended to encoded OID
+ssize_t ber_encode_arcs(const uint32_t *arcs, size_t arcs_cnt, uint8_t *res);
+size_t ber_calc_encoded_arcs_len(const uint32_t *arcs, size_t arcs_cnt);
+
+/*
+ * Decodes up to arcs_max arcs of validated encoding, returns number of arcs in data, which can be greater. Slots after
+ * decoded arcs can be overwritten too.
+ */
+size_t ber_decode_arcs(const uint8_t *data, size_t size, uint32_t *arcs, size_t arcs_max);
+
+int oid_compare(const oid_t *a, const oid_t *b);
+bool oid_is_in_subtree(const oid_t *oid, const oid_t *subtree);
+
+// FNV-1a hash of encoded OID, equal OIDs have equal hashes since encoding is canonical
+uint32_t oid_hash(const oid_t *oid);
 size_t ber_calc_encoded_octet_string_len(const char *data);
 size_t ber_calc_encoded_integer_len(const int *data);
+
+// INTEGER content of 64-bit values, unsigned ones get leading zero octet if their high bit is set
+ssize_t ber_encode_int64(const int64_t *data, uint8_t *res);
+ssize_t ber_encode_uint64(const uint64_t *data, uint8_t *res);
+size_t ber_calc_encoded_int64_len(const int64_t *data);
+size_t ber_calc_encoded_uint64_len(const uint64_t *data);
 size_t ber_calc_encoded_length_len(const size_t *data);
 
 #endif //SNMP_BER_H
@@ -0,0 +1,361 @@
+/*
+ * cache.c
+ * Copyright (c) 2020 Sergei Kosivchenko <archichief@gmail.com>
+ *
+ * smart-snmp is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * smart-snmp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "cache.h"
+#include "singleflight.h"
+#include "utilities.h"
+
+typedef struct cache_rule cache_rule_t;
+
+struct cache_rule {
+    char *name;                                 // subtree as it was given
+    oid_t oid;
+    unsigned long ttl_ms;
+    unsigned long swr_ms;
+
+    atomic_ulong hits;                          // served fresh values
+    atomic_ulong stale_hits;                    // served stale values
+    atomic_ulong misses;                        // getter called on request path
+    atomic_ulong refreshes;                     // getter called by refresher
+    atomic_ulong refresh_errors;
+
+    cache_rule_t *next;
+};
+
+struct cache_slot {
+    pthread_mutex_t lock;
+    mib_entry_t *entry;
+    cache_rule_t *rule;
+
+    uint8_t *val;                               // encoded value
+    size_t val_size;
+    size_t val_cap;
+    unsigned long long updated_ms;              // when value was obtained, 0 if there is no value
+    bool refreshing;                            // slot is queued for refresh or being refreshed
+
+    cache_slot_t *next_queued;
+};
+
+typedef struct cache {
+    cache_rule_t *rules;
+    cache_slot_t *slots;
+    size_t slots_cnt;
+
+    pthread_t thread;
+    bool is_started;
+    int (*thread_init)();
+    void (*thread_free)();
+
+    pthread_mutex_t lock;                       // protects refresh queue
+    pthread_cond_t cond;
+    cache_slot_t *queue_head;
+    cache_slot_t *queue_tail;
+    bool stopped;
+
+    arena_t arena;                              // OIDs of rules
+} cache_t;
+
+static cache_t cache = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static unsigned long long now_ms() {
+    struct timespec ts;
+
+    // coarse clock is precise enough for TTLs and is read without system call
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+    return (unsigned long long) ts.tv_sec * 1000 + (unsigned long long) ts.tv_nsec / 1000000;
+}
+
+// strtoul() skips spaces and accepts sign, so negative number would wrap around to huge one
+static bool parse_ms(const char *str, char **end, unsigned long *res) {
+    if (!isdigit((unsigned char) *str)) return false;
+
+    errno = 0;
+    *res = strtoul(str, end, 10);
+
+    return 0 == errno && *end != str;
+}
+
+int cache_add_rule(const char *spec) {
+    const char *eq = strchr(spec, '=');
+    unsigned long ttl, swr = 0;
+    cache_rule_t *rule;
+    char *end;
+
+    if (NULL == eq || !parse_ms(eq + 1, &end, &ttl) || ('/' == *end && !parse_ms(end + 1, &end, &swr)) ||
+        '\0' != *end) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (NULL == (rule = calloc(1, sizeof(*rule))) || NULL == (rule->name = strndup(spec, (size_t) (eq - spec)))) {
+        free(rule);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (0 != string_to_oid(&cache.arena, rule->name, &rule->oid)) {
+        free(rule->name);
+        free(rule);
+        errno = EINVAL;
+        return -1;
+    }
+
+    rule->ttl_ms = ttl;
+    rule->swr_ms = swr;
+    rule->next = cache.rules;
+    cache.rules = rule;
+
+    return 0;
+}
+
+static cache_rule_t *find_rule(const mib_entry_t *entry) {
+    cache_rule_t *rule, *res = NULL;
+
+    // instances of subtree are created on lookup, so there is nothing to attach slot to
+    if (NULL != entry->subtree) return NULL;
+
+    for (rule = cache.rules; NULL != rule; rule = rule->next) {
+        if (oid_is_in_subtree(&entry->oid, &rule->oid) && (NULL == res || rule->oid.len > res->oid.len)) res = rule;
+    }
+
+    return NULL != res && res->ttl_ms ? res : NULL;
+}
+
+static int count_slot(mib_entry_t *entry, void *arg) {
+    if (NULL != find_rule(entry)) (*(size_t *) arg)++;
+    return 0;
+}
+
+static int attach_slot(mib_entry_t *entry, void *arg) {
+    size_t *i = arg;
+    cache_slot_t *slot;
+    cache_rule_t *rule;
+
+    if (NULL == (rule = find_rule(entry))) return 0;
+
+    slot = &cache.slots[(*i)++];
+    pthread_mutex_init(&slot->lock, NULL);
+    slot->entry = entry;
+    slot->rule = rule;
+    entry->cache = slot;
+
+    return 0;
+}
+
+static void *refresher_routine(__attribute__((unused)) void *arg) {
+    arena_t arena = { 0 };
+    cache_slot_t *slot;
+    size_t val_size;
+    void *val;
+    bool is_ready = NULL == cache.thread_init || 0 == cache.thread_init();
+
+    pthread_mutex_lock(&cache.lock);
+
+    while (!cache.stopped) {
+        if (NULL == (slot = cache.queue_head)) {
+            pthread_cond_wait(&cache.cond, &cache.lock);
+            continue;
+        }
+
+        if (NULL == (cache.queue_head = slot->next_queued)) cache.queue_tail = NULL;
+        pthread_mutex_unlock(&cache.lock);
+
+        // stale value is kept on failure, getter is called on request path when it expires
+        if (is_ready && ERROR_STATUS_NO_ERROR == singleflight_get_encoded(&arena, slot->entry, &val, &val_size)) {
+            cache_put(slot, val, val_size);
+            atomic_fetch_add_explicit(&slot->rule->refreshes, 1, memory_order_relaxed);
+        } else {
+            atomic_fetch_add_explicit(&slot->rule->refresh_errors, 1, memory_order_relaxed);
+        }
+
+        pthread_mutex_lock(&slot->lock);
+        slot->refreshing = false;
+        pthread_mutex_unlock(&slot->lock);
+
+        arena_reset(&arena);
+        pthread_mutex_lock(&cache.lock);
+    }
+
+    pthread_mutex_unlock(&cache.lock);
+
+    if (is_ready && NULL != cache.thread_free) cache.thread_free();
+    arena_free(&arena);
+
+    return NULL;
+}
+
+int cache_start(int (*thread_init)(), void (*thread_free)()) {
+    size_t cnt = 0;
+
+    // entries are changed by attaching slots, so MIB isn't touched without rules
+    if (NULL == cache.rules) return 0;
+
+    mib_foreach(count_slot, &cnt);
+    if (0 == cnt) return 0;
+
+    if (NULL == (cache.slots = calloc(cnt, sizeof(*cache.slots)))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    mib_foreach(attach_slot, &cache.slots_cnt);
+
+    cache.thread_init = thread_init;
+    cache.thread_free = thread_free;
+    cache.stopped = false;
+
+    if (0 != (errno = pthread_create(&cache.thread, NULL, refresher_routine, NULL))) {
+        cache_free();
+        return -1;
+    }
+
+    cache.is_started = true;
+
+    return 0;
+}
+
+static void schedule_refresh(cache_slot_t *slot) {
+    pthread_mutex_lock(&cache.lock);
+
+    slot->next_queued = NULL;
+    if (NULL == cache.queue_tail) {
+        cache.queue_head = slot;
+    } else {
+        cache.queue_tail->next_queued = slot;
+    }
+    cache.queue_tail = slot;
+
+    pthread_cond_signal(&cache.cond);
+    pthread_mutex_unlock(&cache.lock);
+}
+
+bool cache_get(cache_slot_t *slot, arena_t *arena, void **val, size_t *val_size) {
+    cache_rule_t *rule = slot->rule;
+    unsigned long long age;
+    bool refresh = false;
+
+    pthread_mutex_lock(&slot->lock);
+
+    age = now_ms() - slot->updated_ms;
+
+    if (0 == slot->updated_ms || age >= rule->ttl_ms + rule->swr_ms ||
+        NULL == (*val = arena_memdup(arena, slot->val, slot->val_size))) {
+        pthread_mutex_unlock(&slot->lock);
+        atomic_fetch_add_explicit(&rule->misses, 1, memory_order_relaxed);
+        return false;
+    }
+
+    *val_size = slot->val_size;
+
+    if (age >= rule->ttl_ms && !slot->refreshing) {
+        slot->refreshing = refresh = true;
+    }
+
+    pthread_mutex_unlock(&slot->lock);
+
+    if (age < rule->ttl_ms) {
+        atomic_fetch_add_explicit(&rule->hits, 1, memory_order_relaxed);
+    } else {
+        atomic_fetch_add_explicit(&rule->stale_hits, 1, memory_order_relaxed);
+    }
+
+    if (refresh) schedule_refresh(slot);
+
+    return true;
+}
+
+void cache_put(cache_slot_t *slot, const void *val, size_t val_size) {
+    uint8_t *buf;
+
+    pthread_mutex_lock(&slot->lock);
+
+    if (val_size > slot->val_cap) {
+        if (NULL == (buf = realloc(slot->val, val_size))) {
+            pthread_mutex_unlock(&slot->lock);
+            return;
+        }
+
+        slot->val = buf;
+        slot->val_cap = val_size;
+    }
+
+    memcpy(slot->val, val, val_size);
+    slot->val_size = val_size;
+    slot->updated_ms = now_ms();
+
+    pthread_mutex_unlock(&slot->lock);
+}
+
+void cache_print_stats() {
+    const cache_rule_t *rule;
+
+    for (rule = cache.rules; NULL != rule; rule = rule->next) {
+        if (0 == rule->ttl_ms) continue;
+
+        fprintf(stderr, "Cache %s (ttl %lums, swr %lums): hits: %lu, stale hits: %lu, misses: %lu, "
+                        "refreshes: %lu, refresh errors: %lu\n",
+                rule->name, rule->ttl_ms, rule->swr_ms, atomic_load(&rule->hits), atomic_load(&rule->stale_hits),
+                atomic_load(&rule->misses), atomic_load(&rule->refreshes), atomic_load(&rule->refresh_errors));
+    }
+}
+
+void cache_free() {
+    cache_rule_t *rule;
+    size_t i;
+
+    if (cache.is_started) {
+        pthread_mutex_lock(&cache.lock);
+        cache.stopped = true;
+        pthread_cond_signal(&cache.cond);
+        pthread_mutex_unlock(&cache.lock);
+
+        pthread_join(cache.thread, NULL);
+        cache.is_started = false;
+    }
+
+    for (i = 0; i < cache.slots_cnt; i++) {
+        cache.slots[i].entry->cache = NULL;
+        pthread_mutex_destroy(&cache.slots[i].lock);
+        free(cache.slots[i].val);
+    }
+
+    free(cache.slots);
+    cache.slots = NULL;
+    cache.slots_cnt = 0;
+    cache.queue_head = cache.queue_tail = NULL;
+
+    while (NULL != (rule = cache.rules)) {
+        cache.rules = rule->next;
+        free(rule->name);
+        free(rule);
+    }
+
+    arena_free(&cache.arena);
+}
@@ -0,0 +1,50 @@
+/*
+ * cache.h
+ * Copyright (c) 2020 Sergei Kosivchenko <archichief@gmail.com>
+ *
+ * smart-snmp is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * smart-snmp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SNMP_CACHE_H
+#define SNMP_CACHE_H
+
+#include <stdbool.h>
+
+#include "arena.h"
+#include "mib.h"
+
+/*
+ * Adds caching rule for subtree given as "OID=TTL[/SWR]", both in milliseconds. Value of entry is served from cache
+ * for TTL after it was obtained. During next SWR milliseconds stale value is still served, while it is refreshed by
+ * background thread. Most specific rule applies to entry, rule with zero TTL turns caching off for its subtree.
+ */
+int cache_add_rule(const char *spec);
+
+/*
+ * Attaches cache slots to entries covered by rules and starts refresher thread, must be called when MIB is complete.
+ * thread_init and thread_free, if given, are called by refresher thread, so getters needing per-thread state work.
+ */
+int cache_start(int (*thread_init)(), void (*thread_free)());
+
+// copies cached encoded value into arena, returns false if there is no value to serve
+bool cache_get(cache_slot_t *slot, arena_t *arena, void **val, size_t *val_size);
+void cache_put(cache_slot_t *slot, const void *val, size_t val_size);
+
+// prints hit/miss/refresh counters of every rule
+void cache_print_stats();
+
+// stops refresher thread and detaches slots from MIB entries
+void cache_free();
+
+#endif //SNMP_CACHE_H
@@ -0,0 +1,156 @@
+/*
+ * deadline.c
+ * Copyright (c) 2020 Sergei Kosivchenko <archichief@gmail.com>
+ *
+ * smart-snmp is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * smart-snmp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+
+#include "deadline.h"
+#include "utilities.h"
+
+struct deadline_rule {
+    char *name;                                 // subtree as it was given
+    oid_t oid;
+    unsigned long ms;
+
+    atomic_ulong misses;                        // values which didn't arrive in time
+
+    deadline_rule_t *next;
+};
+
+typedef struct deadline {
+    deadline_rule_t request;                    // applies to every varbind, misses of entries without rule
+    deadline_rule_t *rules;
+    arena_t arena;                              // OIDs of rules
+} deadline_t;
+
+static deadline_t deadline = {
+        .request = { .name = "request", .ms = SNMP_DEADLINE_REQUEST_MS },
+};
+
+static int parse_ms(const char *str, unsigned long *ms) {
+    char *end;
+
+    errno = 0;
+    *ms = strtoul(str, &end, 10);
+
+    if (errno || '\0' == *str || '\0' != *end || '-' == *str) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+int deadline_add_rule(const char *spec) {
+    const char *eq = strchr(spec, '=');
+    deadline_rule_t *rule;
+    unsigned long ms;
+
+    if (NULL == eq) return parse_ms(spec, &deadline.request.ms);
+
+    if (0 != parse_ms(eq + 1, &ms)) return -1;
+
+    if (NULL == (rule = calloc(1, sizeof(*rule))) || NULL == (rule->name = strndup(spec, (size_t) (eq - spec)))) {
+        free(rule);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (0 != string_to_oid(&deadline.arena, rule->name, &rule->oid)) {
+        free(rule->name);
+        free(rule);
+        errno = EINVAL;
+        return -1;
+    }
+
+    rule->ms = ms;
+    rule->next = deadline.rules;
+    deadline.rules = rule;
+
+    return 0;
+}
+
+// instances of subtree are copies of its entry, so rule of subtree applies to them too
+static int attach_rule(mib_entry_t *entry, __attribute__((unused)) void *arg) {
+    deadline_rule_t *rule, *res = NULL;
+
+    for (rule = deadline.rules; NULL != rule; rule = rule->next) {
+        if (oid_is_in_subtree(&entry->oid, &rule->oid) && (NULL == res || rule->oid.len > res->oid.len)) res = rule;
+    }
+
+    entry->deadline = NULL != res && res->ms ? res : NULL;
+
+    return 0;
+}
+
+static int detach_rule(mib_entry_t *entry, __attribute__((unused)) void *arg) {
+    entry->deadline = NULL;
+    return 0;
+}
+
+int deadline_start() {
+    // entries are changed by attaching rules, so MIB isn't touched without them
+    if (NULL == deadline.rules) return 0;
+
+    return mib_foreach(attach_rule, NULL);
+}
+
+unsigned long deadline_get(const mib_entry_t *entry) {
+    unsigned long ms = deadline.request.ms;
+
+    if (NULL != entry->deadline && (0 == ms || entry->deadline->ms < ms)) ms = entry->deadline->ms;
+
+    return ms;
+}
+
+void deadline_miss(const mib_entry_t *entry) {
+    deadline_rule_t *rule = NULL != entry->deadline ? entry->deadline : &deadline.request;
+
+    atomic_fetch_add_explicit(&rule->misses, 1, memory_order_relaxed);
+}
+
+void deadline_print_stats() {
+    const deadline_rule_t *rule;
+
+    if (0 != deadline.request.ms) {
+        fprintf(stderr, "Deadline of request (%lums): misses: %lu\n", deadline.request.ms,
+                atomic_load(&deadline.request.misses));
+    }
+
+    for (rule = deadline.rules; NULL != rule; rule = rule->next) {
+        if (0 == rule->ms) continue;
+
+        fprintf(stderr, "Deadline %s (%lums): misses: %lu\n", rule->name, rule->ms, atomic_load(&rule->misses));
+    }
+}
+
+void deadline_free() {
+    deadline_rule_t *rule;
+
+    if (NULL != deadline.rules) mib_foreach(detach_rule, NULL);
+
+    while (NULL != (rule = deadline.rules)) {
+        deadline.rules = rule->next;
+        free(rule->name);
+        free(rule);
+    }
+
+    arena_free(&deadline.arena);
+}
@@ -0,0 +1,51 @@
+/*
+ * deadline.h
+ * Copyright (c) 2020 Sergei Kosivchenko <archichief@gmail.com>
+ *
+ * smart-snmp is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * smart-snmp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SNMP_DEADLINE_H
+#define SNMP_DEADLINE_H
+
+#include "mib.h"
+
+// time request waits for asynchronous values, manager usually retries after 1 second
+#ifndef SNMP_DEADLINE_REQUEST_MS
+#define SNMP_DEADLINE_REQUEST_MS 500
+#endif
+
+/*
+ * Adds deadline given as "MS" for the whole request or as "OID=MS" for entries of subtree, in milliseconds. Varbind
+ * waits for its value until the shorter of both deadlines passes. Most specific rule applies to entry, zero turns
+ * deadline off for request or leaves only deadline of request for subtree.
+ */
+int deadline_add_rule(const char *spec);
+
+// attaches rules to entries covered by them, must be called when MIB is complete
+int deadline_start();
+
+// time value of entry is waited for, 0 if it's waited for without limit
+unsigned long deadline_get(const mib_entry_t *entry);
+
+// counts value of entry which didn't arrive in time, thread-safe
+void deadline_miss(const mib_entry_t *entry);
+
+// prints miss counters of request and every subtree rule
+void deadline_print_stats();
+
+// detaches rules from MIB entries
+void deadline_free();
+
+#endif //SNMP_DEADLINE_H
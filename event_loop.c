@@ -0,0 +1,296 @@
+/*
+ * event_loop.c
+ * Copyright (c) 2020 Sergei Kosivchenko <archichief@gmail.com>
+ *
+ * smart-snmp is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * smart-snmp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "event_loop.h"
+
+#ifndef SNMP_EVENT_LOOP_MAX_EVENTS
+#define SNMP_EVENT_LOOP_MAX_EVENTS 64
+#endif
+
+struct event_source {
+    int fd;
+    bool is_timer;                              // descriptor is timerfd owned by loop
+    event_handler_t handler;
+    void *user_data;
+    event_source_t *next;
+};
+
+static unsigned long long now_tick() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((unsigned long long) ts.tv_sec * 1000 + (unsigned long long) ts.tv_nsec / 1000000) /
+           SNMP_EVENT_LOOP_TICK_MS;
+}
+
+static int arm_wheel(event_loop_t *loop, bool is_armed) {
+    struct itimerspec spec = { 0 };
+
+    if (is_armed) {
+        spec.it_interval.tv_sec = SNMP_EVENT_LOOP_TICK_MS / 1000;
+        spec.it_interval.tv_nsec = (long)(SNMP_EVENT_LOOP_TICK_MS % 1000) * 1000000L;
+        spec.it_value = spec.it_interval;
+    }
+
+    return timerfd_settime(loop->wheelfd, 0, &spec, NULL);
+}
+
+static void unlink_timeout(event_loop_t *loop, event_timeout_t *timeout) {
+    if (NULL != timeout->prev) {
+        timeout->prev->next = timeout->next;
+    } else {
+        loop->wheel[timeout->expires % SNMP_EVENT_LOOP_WHEEL_SLOTS] = timeout->next;
+    }
+
+    if (NULL != timeout->next) timeout->next->prev = timeout->prev;
+
+    timeout->is_active = false;
+
+    // idle loop doesn't tick
+    if (0 == --loop->timeouts_cnt) arm_wheel(loop, false);
+}
+
+// fires timeouts of every tick passed since previous call
+static void handle_wheel(event_loop_t *loop, __attribute__((unused)) int fd, __attribute__((unused)) uint32_t events,
+                         __attribute__((unused)) void *user_data) {
+    unsigned long long now = now_tick();
+    event_timeout_t *timeout;
+
+    // after long stall every slot is visited once, it's enough to find all expired timeouts
+    if (now - loop->tick > SNMP_EVENT_LOOP_WHEEL_SLOTS) loop->tick = now - SNMP_EVENT_LOOP_WHEEL_SLOTS;
+
+    while (loop->tick < now && loop->timeouts_cnt > 0) {
+        timeout = loop->wheel[++loop->tick % SNMP_EVENT_LOOP_WHEEL_SLOTS];
+
+        while (NULL != timeout) {
+            // timeout of later turn shares slot
+            if (timeout->expires > loop->tick) {
+                timeout = timeout->next;
+                continue;
+            }
+
+            unlink_timeout(loop, timeout);
+            timeout->handler(loop, timeout);
+
+            // handler can cancel other timeouts of slot, so it is walked from the beginning
+            timeout = loop->wheel[loop->tick % SNMP_EVENT_LOOP_WHEEL_SLOTS];
+        }
+    }
+}
+
+int event_loop_init(event_loop_t *loop) {
+    struct epoll_event ev = { .events = EPOLLIN };
+    size_t i;
+
+    atomic_store(&loop->stopped, false);
+    loop->sources = NULL;
+    loop->stopfd = -1;
+    loop->wheelfd = -1;
+    loop->timeouts_cnt = 0;
+
+    for (i = 0; i < SNMP_EVENT_LOOP_WHEEL_SLOTS; i++) loop->wheel[i] = NULL;
+
+    if (-1 == (loop->epfd = epoll_create1(EPOLL_CLOEXEC))) return -1;
+
+    if (-1 == (loop->stopfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))) goto fail;
+
+    // stop event has no source, data.ptr stays NULL
+    ev.data.ptr = NULL;
+    if (-1 == epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->stopfd, &ev)) goto fail;
+
+    // wheel is created disarmed, it's closed as any other timer of loop
+    if (-1 == (loop->wheelfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC))) goto fail;
+
+    if (-1 == event_loop_add_fd(loop, loop->wheelfd, EPOLLIN, handle_wheel, NULL)) {
+        close(loop->wheelfd);
+        loop->wheelfd = -1;
+        goto fail;
+    }
+
+    loop->sources->is_timer = true;
+
+    return 0;
+
+    fail:
+    event_loop_free(loop);
+    return -1;
+}
+
+int event_loop_add_fd(event_loop_t *loop, int fd, uint32_t events, event_handler_t handler, void *user_data) {
+    struct epoll_event ev;
+    event_source_t *source;
+
+    if (NULL == (source = malloc(sizeof(*source)))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    source->fd = fd;
+    source->is_timer = false;
+    source->handler = handler;
+    source->user_data = user_data;
+
+    ev.events = events | EPOLLET;
+    ev.data.ptr = source;
+
+    if (-1 == epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev)) {
+        free(source);
+        return -1;
+    }
+
+    source->next = loop->sources;
+    loop->sources = source;
+
+    return 0;
+}
+
+int event_loop_del_fd(event_loop_t *loop, int fd) {
+    event_source_t **link = &loop->sources, *source;
+
+    while (NULL != (source = *link) && source->fd != fd) link = &source->next;
+
+    if (NULL == source) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    *link = source->next;
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+
+    if (source->is_timer) close(fd);
+    free(source);
+
+    return 0;
+}
+
+int event_loop_add_timer(event_loop_t *loop, unsigned int interval_ms, event_handler_t handler, void *user_data) {
+    struct itimerspec spec;
+    int fd;
+
+    spec.it_interval.tv_sec = interval_ms / 1000;
+    spec.it_interval.tv_nsec = (long)(interval_ms % 1000) * 1000000L;
+    spec.it_value = spec.it_interval;
+
+    if (-1 == (fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC))) return -1;
+
+    if (-1 == timerfd_settime(fd, 0, &spec, NULL) ||
+        -1 == event_loop_add_fd(loop, fd, EPOLLIN, handler, user_data)) {
+        close(fd);
+        return -1;
+    }
+
+    loop->sources->is_timer = true;
+
+    return fd;
+}
+
+int event_loop_add_timeout(event_loop_t *loop, event_timeout_t *timeout, unsigned int timeout_ms) {
+    unsigned long long now = now_tick(), ticks = (timeout_ms + SNMP_EVENT_LOOP_TICK_MS - 1) / SNMP_EVENT_LOOP_TICK_MS;
+    event_timeout_t **slot;
+
+    event_loop_cancel_timeout(loop, timeout);
+
+    if (0 == loop->timeouts_cnt) {
+        if (-1 == arm_wheel(loop, true)) return -1;
+        loop->tick = now;
+    }
+
+    // current tick may be already handled
+    timeout->expires = now + (ticks > 0 ? ticks : 1);
+    slot = &loop->wheel[timeout->expires % SNMP_EVENT_LOOP_WHEEL_SLOTS];
+
+    timeout->prev = NULL;
+    timeout->next = *slot;
+    if (NULL != *slot) (*slot)->prev = timeout;
+    *slot = timeout;
+
+    timeout->is_active = true;
+    loop->timeouts_cnt++;
+
+    return 0;
+}
+
+void event_loop_cancel_timeout(event_loop_t *loop, event_timeout_t *timeout) {
+    if (timeout->is_active) unlink_timeout(loop, timeout);
+}
+
+int event_loop_run(event_loop_t *loop) {
+    struct epoll_event events[SNMP_EVENT_LOOP_MAX_EVENTS];
+    event_source_t *source;
+    uint64_t expirations;
+    int i, cnt;
+
+    while (!atomic_load(&loop->stopped)) {
+        if (-1 == (cnt = epoll_wait(loop->epfd, events, SNMP_EVENT_LOOP_MAX_EVENTS, -1))) {
+            if (EINTR == errno) continue;
+            return -1;
+        }
+
+        for (i = 0; i < cnt && !atomic_load(&loop->stopped); i++) {
+            if (NULL == (source = events[i].data.ptr)) {
+                atomic_store(&loop->stopped, true);
+                break;
+            }
+
+            // timer must be read, otherwise it won't be reported again
+            if (source->is_timer) {
+                while (read(source->fd, &expirations, sizeof(expirations)) > 0);
+            }
+
+            source->handler(loop, source->fd, events[i].events, source->user_data);
+        }
+    }
+
+    return 0;
+}
+
+void event_loop_stop(event_loop_t *loop) {
+    uint64_t val = 1;
+
+    atomic_store(&loop->stopped, true);
+
+    // eventfd write is async-signal-safe, result doesn't matter: counter overflow means loop is already woken up
+    if (write(loop->stopfd, &val, sizeof(val)) < 0) return;
+}
+
+void event_loop_free(event_loop_t *loop) {
+    event_source_t *source;
+
+    while (NULL != (source = loop->sources)) {
+        loop->sources = source->next;
+
+        if (source->is_timer) close(source->fd);
+        free(source);
+    }
+
+    if (loop->stopfd >= 0) close(loop->stopfd);
+    if (loop->epfd >= 0) close(loop->epfd);
+
+    loop->stopfd = -1;
+    loop->epfd = -1;
+    loop->wheelfd = -1;
+}
@@ -0,0 +1,102 @@
+/*
+ * event_loop.h
+ * Copyright (c) 2020 Sergei Kosivchenko <archichief@gmail.com>
+ *
+ * smart-snmp is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * smart-snmp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SNMP_EVENT_LOOP_H
+#define SNMP_EVENT_LOOP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+typedef struct event_loop event_loop_t;
+typedef struct event_source event_source_t;
+typedef struct event_timeout event_timeout_t;
+
+// resolution of timeouts
+#ifndef SNMP_EVENT_LOOP_TICK_MS
+#define SNMP_EVENT_LOOP_TICK_MS 10
+#endif
+
+// timeouts longer than full turn of wheel just wait for more turns
+#ifndef SNMP_EVENT_LOOP_WHEEL_SLOTS
+#define SNMP_EVENT_LOOP_WHEEL_SLOTS 256
+#endif
+
+/*
+ * Called when registered file descriptor is ready. Descriptors are registered in edge-triggered mode, so handler must
+ * read or write until EAGAIN.
+ */
+typedef void (*event_handler_t)(event_loop_t *loop, int fd, uint32_t events, void *user_data);
+
+typedef void (*event_timeout_handler_t)(event_loop_t *loop, event_timeout_t *timeout);
+
+// one-shot timeout, its memory is owned by caller, zeroed before first use and kept until timeout fires or is cancelled
+struct event_timeout {
+    event_timeout_handler_t handler;
+    void *user_data;
+    unsigned long long expires;                 // tick of loop
+    bool is_active;
+    event_timeout_t *prev;
+    event_timeout_t *next;
+};
+
+struct event_loop {
+    int epfd;                                   // epoll instance
+    int stopfd;                                 // eventfd used to wake up loop and stop it
+    atomic_bool stopped;                        // set by event_loop_stop() from any thread
+    event_source_t *sources;                    // registered descriptors
+
+    int wheelfd;                                // timerfd ticking only while there are active timeouts
+    unsigned long long tick;                    // the last tick which timeouts have fired
+    size_t timeouts_cnt;
+    event_timeout_t *wheel[SNMP_EVENT_LOOP_WHEEL_SLOTS];
+};
+
+int event_loop_init(event_loop_t *loop);
+
+/*
+ * Descriptor can be removed from its own handler, but not from handler of other descriptor since its event can be
+ * already fetched by current iteration of loop.
+ */
+int event_loop_add_fd(event_loop_t *loop, int fd, uint32_t events, event_handler_t handler, void *user_data);
+int event_loop_del_fd(event_loop_t *loop, int fd);
+
+/*
+ * Creates timerfd firing every interval_ms milliseconds and registers it in loop. Expirations are consumed by loop
+ * before handler is called. Returns timer descriptor which can be removed with event_loop_del_fd().
+ */
+int event_loop_add_timer(event_loop_t *loop, unsigned int interval_ms, event_handler_t handler, void *user_data);
+
+/*
+ * Calls handler of timeout by loop once timeout_ms milliseconds pass, rounded up to tick. Timeouts are kept in hashed
+ * wheel, so adding and cancelling cost the same regardless of their number. Handler can add and cancel timeouts.
+ */
+int event_loop_add_timeout(event_loop_t *loop, event_timeout_t *timeout, unsigned int timeout_ms);
+
+// does nothing if timeout isn't active
+void event_loop_cancel_timeout(event_loop_t *loop, event_timeout_t *timeout);
+
+// waits for events until event_loop_stop() is called, idle loop never wakes up
+int event_loop_run(event_loop_t *loop);
+
+// can be called from any thread or signal handler
+void event_loop_stop(event_loop_t *loop);
+
+void event_loop_free(event_loop_t *loop);
+
+#endif //SNMP_EVENT_LOOP_H
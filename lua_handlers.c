@@ -0,0 +1,362 @@
+/*
+ * lua_handlers.c
+ * Copyright (c) 2020 Sergei Kosivchenko <archichief@gmail.com>
+ *
+ * smart-snmp is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * smart-snmp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include "lua_handlers.h"
+#include "utilities.h"
+
+typedef struct lua_handler lua_handler_t;
+
+struct lua_handler {
+    char *path;
+    object_type_t type;
+    size_t index;                               // position of handler functions in per-thread state
+    char *code;                                 // precompiled chunk
+    size_t code_size;
+    lua_handler_t *next;
+};
+
+// per-thread Lua state with references to handler functions
+typedef struct lua_worker {
+    lua_State *L;
+    int *get_refs;
+    int *set_refs;
+} lua_worker_t;
+
+static lua_handler_t *handlers;
+static size_t handlers_cnt;
+
+static __thread lua_worker_t worker;
+
+static int dump_writer(__attribute__((unused)) lua_State *L, const void *p, size_t size, void *ud) {
+    lua_handler_t *handler = ud;
+    char *code;
+
+    if (NULL == (code = realloc(handler->code, handler->code_size + size))) return 1;
+
+    memcpy(code + handler->code_size, p, size);
+    handler->code = code;
+    handler->code_size += size;
+
+    return 0;
+}
+
+// converts value on top of the stack into value of getter
+static int to_value(lua_State *L, mib_value_t *value) {
+    lua_Integer int_val;
+    uint32_t *subids;
+    const char *str;
+    size_t i, len;
+    oid_t oid;
+    int is_num;
+
+    switch (value->type) {
+        case OBJECT_TYPE_INTEGER:
+            int_val = lua_tointegerx(L, -1, &is_num);
+            if (!is_num) return -1;
+
+            return mib_value_set_integer(value, int_val);
+        case OBJECT_TYPE_COUNTER:
+        case OBJECT_TYPE_GAUGE:
+        case OBJECT_TYPE_TIMETICKS:
+        case OBJECT_TYPE_COUNTER64:
+            // Lua integers are signed, so Counter64 is limited by 2^63
+            int_val = lua_tointegerx(L, -1, &is_num);
+            if (!is_num || int_val < 0) return -1;
+
+            return mib_value_set_unsigned(value, (uint64_t) int_val);
+        case OBJECT_TYPE_OCTET_STRING:
+            // strings are binary safe
+            if (LUA_TSTRING != lua_type(L, -1) || NULL == (str = lua_tolstring(L, -1, &len))) return -1;
+
+            return mib_value_set_bytes(value, str, len);
+        case OBJECT_TYPE_OID:
+            if (LUA_TSTRING == lua_type(L, -1)) {
+                if (0 != string_to_oid(value->arena, lua_tostring(L, -1), &oid)) return -1;
+            } else if (LUA_TTABLE == lua_type(L, -1)) {
+                // arcs are encoded right from the table without building string
+                len = lua_rawlen(L, -1);
+                if (NULL == (subids = arena_alloc(value->arena, (len ? len : 1) * sizeof(*subids)))) return -1;
+
+                for (i = 0; i < len; i++) {
+                    lua_rawgeti(L, -1, (lua_Integer) i + 1);
+                    int_val = lua_tointegerx(L, -1, &is_num);
+                    lua_pop(L, 1);
+
+                    if (!is_num || int_val < 0 || int_val > UINT32_MAX) return -1;
+                    subids[i] = (uint32_t) int_val;
+                }
+
+                oid.len = ber_calc_encoded_subids_len(subids, len);
+                if (NULL == (oid.data = arena_alloc(value->arena, oid.len ? oid.len : 1)) ||
+                    ber_encode_subids(subids, len, (uint8_t *) oid.data) < 0) {
+                    return -1;
+                }
+            } else {
+                return -1;
+            }
+
+            return mib_value_set_oid(value, &oid);
+        default:
+            return -1;
+    }
+}
+
+static int lua_get(void *data, mib_value_t *value) {
+    const lua_handler_t *handler = data;
+    lua_State *L = worker.L;
+    int rv;
+
+    if (NULL == L) return -1;
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, worker.get_refs[handler->index]);
+    if (LUA_OK != lua_pcall(L, 0, 1, 0)) {
+        lua_pop(L, 1);
+        return -1;
+    }
+
+    rv = to_value(L, value);
+    lua_pop(L, 1);
+
+    return rv;
+}
+
+static int lua_set(void *data, const void *res, size_t size) {
+    const lua_handler_t *handler = data;
+    lua_State *L = worker.L;
+    lua_Integer status = ERROR_STATUS_NO_ERROR;
+    char *str;
+    int is_num = 1;
+
+    if (NULL == L) return ERROR_STATUS_GEN_ERR;
+
+    if (LUA_NOREF == worker.set_refs[handler->index]) return ERROR_STATUS_READ_ONLY;
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, worker.set_refs[handler->index]);
+
+    switch (handler->type) {
+        case OBJECT_TYPE_INTEGER:
+            lua_pushinteger(L, *(const int *) res);
+            break;
+        case OBJECT_TYPE_OCTET_STRING:
+            lua_pushlstring(L, res, size);
+            break;
+        case OBJECT_TYPE_OID:
+            if (NULL == (str = oid_to_string(res))) {
+                lua_pop(L, 1);
+                return ERROR_STATUS_GEN_ERR;
+            }
+
+            lua_pushstring(L, str + 1);
+            free(str);
+            break;
+        default:
+            lua_pop(L, 1);
+            return ERROR_STATUS_GEN_ERR;
+    }
+
+    if (LUA_OK != lua_pcall(L, 1, 1, 0)) {
+        lua_pop(L, 1);
+        return ERROR_STATUS_GEN_ERR;
+    }
+
+    // nothing returned means noError
+    if (!lua_isnil(L, -1)) status = lua_tointegerx(L, -1, &is_num);
+    lua_pop(L, 1);
+
+    return !is_num || status < 0 || status > INT_MAX ? ERROR_STATUS_GEN_ERR : (int) status;
+}
+
+// compiles script, runs it in discovery state and registers OID it handles
+static int load_handler(lua_State *L, const char *path, arena_t *arena) {
+    mib_entry_t entry = { 0 };
+    lua_handler_t *handler;
+    oid_t oid;
+
+    if (NULL == (handler = calloc(1, sizeof(*handler))) || NULL == (handler->path = strdup(path))) {
+        free(handler);
+        return -1;
+    }
+
+    handler->index = handlers_cnt;
+    handler->next = handlers;
+    handlers = handler;
+    handlers_cnt++;
+
+    if (LUA_OK != luaL_loadfile(L, path) || 0 != lua_dump(L, dump_writer, handler, 0) ||
+        LUA_OK != lua_pcall(L, 0, 1, 0) || !lua_istable(L, -1)) {
+        fprintf(stderr, "Lua script %s can't be loaded: %s\n", path,
+                lua_isstring(L, -1) ? lua_tostring(L, -1) : "table of handlers expected");
+        errno = EINVAL;
+        return -1;
+    }
+
+    lua_getfield(L, -1, "oid");
+    lua_getfield(L, -2, "type");
+    lua_getfield(L, -3, "get");
+
+    if (!lua_isstring(L, -3) || 0 != string_to_oid(arena, lua_tostring(L, -3), &oid) ||
+        0 != string_to_type(lua_tostring(L, -2), &handler->type) || !lua_isfunction(L, -1)) {
+        fprintf(stderr, "Lua script %s doesn't define valid oid, type or get function\n", path);
+        errno = EINVAL;
+        return -1;
+    }
+
+    // handler declared slow runs in pool, speed of other ones is measured
+    lua_getfield(L, -4, "slow");
+    entry.speed = lua_toboolean(L, -1) ? MIB_SPEED_SLOW : MIB_SPEED_AUTO;
+
+    // OIDs handled twice are reported by mib_build_index() with paths of both scripts
+    entry.oid = oid;
+    entry.type = handler->type;
+    entry.get_value = lua_get;
+    entry.set = lua_set;
+    entry.data = handler;
+    entry.origin = handler->path;
+    // every thread calls handler in its own Lua state
+    entry.is_thread_safe = true;
+
+    return mib_add_entries(&entry, 1);
+}
+
+ssize_t lua_handlers_load(const char *dir) {
+    char path[PATH_MAX];
+    arena_t arena = { .block_size = 1024 };
+    struct dirent *de;
+    ssize_t cnt = 0;
+    lua_State *L;
+    size_t len;
+    DIR *d;
+    int rv;
+
+    if (NULL == (d = opendir(dir))) return -1;
+
+    // scripts are checked in separate state, workers get only their bytecode
+    if (NULL == (L = luaL_newstate())) {
+        closedir(d);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    luaL_openlibs(L);
+
+    while (NULL != (de = readdir(d))) {
+        len = strlen(de->d_name);
+        if ('.' == de->d_name[0] || len < 4 || 0 != strcmp(de->d_name + len - 4, ".lua")) continue;
+
+        if ((size_t) snprintf(path, sizeof(path), "%s/%s", dir, de->d_name) >= sizeof(path)) {
+            errno = ENAMETOOLONG;
+            goto fail;
+        }
+
+        if (0 != load_handler(L, path, &arena)) goto fail;
+
+        lua_settop(L, 0);
+        arena_reset(&arena);
+        cnt++;
+    }
+
+    lua_close(L);
+    closedir(d);
+    arena_free(&arena);
+
+    return cnt;
+
+    fail:
+    rv = errno;
+    lua_close(L);
+    closedir(d);
+    arena_free(&arena);
+    errno = rv;
+
+    return -1;
+}
+
+int lua_handlers_attach() {
+    const lua_handler_t *handler;
+
+    if (0 == handlers_cnt) return 0;
+
+    if (NULL == (worker.L = luaL_newstate()) ||
+        NULL == (worker.get_refs = malloc(handlers_cnt * sizeof(*worker.get_refs))) ||
+        NULL == (worker.set_refs = malloc(handlers_cnt * sizeof(*worker.set_refs)))) {
+        errno = ENOMEM;
+        goto fail;
+    }
+
+    luaL_openlibs(worker.L);
+
+    for (handler = handlers; NULL != handler; handler = handler->next) {
+        // only precompiled chunks are accepted, scripts are not parsed again
+        if (LUA_OK != luaL_loadbufferx(worker.L, handler->code, handler->code_size, handler->path, "b") ||
+            LUA_OK != lua_pcall(worker.L, 0, 1, 0) || !lua_istable(worker.L, -1)) {
+            errno = EINVAL;
+            goto fail;
+        }
+
+        lua_getfield(worker.L, -1, "get");
+        worker.get_refs[handler->index] = luaL_ref(worker.L, LUA_REGISTRYINDEX);
+
+        // handler without setter is read-only
+        lua_getfield(worker.L, -1, "set");
+        if (lua_isfunction(worker.L, -1)) {
+            worker.set_refs[handler->index] = luaL_ref(worker.L, LUA_REGISTRYINDEX);
+        } else {
+            worker.set_refs[handler->index] = LUA_NOREF;
+        }
+
+        lua_settop(worker.L, 0);
+    }
+
+    return 0;
+
+    fail:
+    lua_handlers_detach();
+    return -1;
+}
+
+void lua_handlers_detach() {
+    if (NULL != worker.L) lua_close(worker.L);
+    free(worker.get_refs);
+    free(worker.set_refs);
+
+    memset(&worker, 0, sizeof(worker));
+}
+
+void lua_handlers_free() {
+    lua_handler_t *handler;
+
+    while (NULL != (handler = handlers)) {
+        handlers = handler->next;
+
+        free(handler->path);
+        free(handler->code);
+        free(handler);
+    }
+
+    handlers_cnt = 0;
+}
@@ -0,0 +1,47 @@
+/*
+ * lua_handlers.h
+ * Copyright (c) 2020 Sergei Kosivchenko <archichief@gmail.com>
+ *
+ * smart-snmp is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * smart-snmp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SNMP_LUA_HANDLERS_H
+#define SNMP_LUA_HANDLERS_H
+
+#include <sys/types.h>
+
+#include "mib.h"
+
+/*
+ * Compiles every *.lua script in directory and registers OID it handles in MIB. Script must return table:
+ *     return {
+ *         oid = "1.3.6.1.2.1.1.5.0",
+ *         type = "STRING",                -- INTEGER, STRING or OID
+ *         get = function() return "value" end,
+ *         set = function(value) return 4 end,   -- optional, returns SNMP error-status
+ *     }
+ * OID values are returned either as string or as table of arcs. Returns number of registered scripts.
+ */
+ssize_t lua_handlers_load(const char *dir);
+
+/*
+ * Creates Lua state of calling thread and loads precompiled handlers into it. Handlers are called only in the
+ * thread's own state, so workers don't share any interpreter lock. Thread without state fails all Lua getters.
+ */
+int lua_handlers_attach();
+void lua_handlers_detach();
+
+void lua_handlers_free();
+
+#endif //SNMP_LUA_HANDLERS_H
@@ -16,6 +16,8 @@
  * with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
+
 #include <stdint.h>
 #include <memory.h>
 #include <errno.h>
@@ -27,34 +29,112 @@
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <time.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 
 
 #include "processor.h"
+#include "event_loop.h"
 #include "mib.h"
+#include "mib_table.h"
+#include "utilities.h"
+#include "script.h"
+#include "cache.h"
+#include "deadline.h"
+#include "pool.h"
+#ifdef SNMP_WITH_LUA
+#include "lua_handlers.h"
+#endif
+
+#ifdef SNMP_WITH_IO_URING
+#include "uring.h"
+#endif
+
+#ifndef SNMP_BATCH_SIZE_MAX
+#define SNMP_BATCH_SIZE_MAX 1024
+#endif
+
+// responses of batch are stacked here, must hold at least one datagram of the largest size
+#ifndef SNMP_BATCH_BUFFER_SIZE
+#define SNMP_BATCH_BUFFER_SIZE (1024 * 1024)
+#endif
+
+_Static_assert(SNMP_BATCH_BUFFER_SIZE >= SNMP_MAX_DATAGRAM_SIZE,
+               "SNMP_BATCH_BUFFER_SIZE must hold response of SNMP_MAX_DATAGRAM_SIZE");
+
+#ifndef SNMP_WORKERS_MAX
+#define SNMP_WORKERS_MAX 256
+#endif
 
 typedef struct snmp_client {
-    time_t          timestamp;
-    int             sockfd;
-    struct in_addr  addr;
-    in_port_t       port;
-    uint8_t         packet[BUFSIZ];
-    size_t          size;
+    time_t              timestamp;
+    int                 sockfd;
+    struct sockaddr_in  sockaddr;
+    socklen_t           socklen;
+    uint8_t             packet[BUFSIZ];
+    size_t              size;
 } snmp_client_t;
 
+// ring of clients served by single recvmmsg()/sendmmsg() pair
+typedef struct snmp_batch {
+    size_t              size;                   // number of slots
+    snmp_client_t       *clients;
+    struct mmsghdr      *in_msgs;
+    struct iovec        *in_iovs;
+    struct mmsghdr      *out_msgs;
+    struct iovec        *out_iovs;
+    uint8_t             *responses;             // SNMP_BATCH_BUFFER_SIZE bytes shared by all slots
+} snmp_batch_t;
+
+// shows how well batches are filled
+typedef struct snmp_batch_stats {
+    unsigned long long  batches;                // recvmmsg() calls what returned datagrams
+    unsigned long long  datagrams;              // datagrams received
+    unsigned long long  full_batches;           // batches where all slots were filled
+    unsigned long long  responses;              // responses sent
+} snmp_batch_stats_t;
 
-static snmp_client_t client;
-
-
-static int sockfd;
-
-static volatile int finish;
-
-static int configure_socket() {
+/*
+ * Every worker owns its socket bound to the same port with SO_REUSEPORT, buffers and arena, so workers share nothing
+ * except of MIB, which is read only once workers are started.
+ */
+typedef struct snmp_worker {
+    pthread_t           thread;
+    int                 sockfd;
+    snmp_client_t       client;
+    uint8_t             response[SNMP_MAX_DATAGRAM_SIZE];
+    snmp_batch_t        batch;
+    snmp_batch_stats_t  batch_stats;
+    arena_t             arena;
+    event_loop_t        loop;
+    event_loop_t        *main_loop;             // loop of main thread, stopped by worker what fails
+    bool                failed;                 // worker couldn't serve requests, agent must exit with error
+    snmp_processor_t    *processor;             // requests waiting for asynchronous values
+#ifdef SNMP_WITH_IO_URING
+    uring_transport_t   *uring;                 // NULL if kernel doesn't support io_uring transport
+#endif
+} snmp_worker_t;
+
+
+static size_t batch_size = 1;
+static size_t workers_cnt = 1;
+static size_t slow_threads = SNMP_POOL_THREADS;
+static const char *scripts_dir = NULL;
+static const char *discovery_cache = NULL;
+
+
+// returns 0, getaddrinfo() error code or errno value, see socket_error()
+static int configure_socket(snmp_worker_t *worker) {
     const char *hostname = "0.0.0.0";
     const char *portname = "1993";
     struct addrinfo addr_hint;
     struct addrinfo *addr = NULL;
-    int ret;
+    int ret, reuse = 1;
 
     /* Configure sockets listen address, port and type*/
     memset(&addr_hint, 0, sizeof(addr_hint));
@@ -69,13 +149,20 @@ static int configure_socket() {
     }
 
     /* Open UDP socket and bind it to machine address and SNMP port */
-    if (-1 == (sockfd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol))) {
+    if (-1 == (worker->sockfd = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK, addr->ai_protocol))) {
 //        log_critical("Failed to open UDP socket: %s", strerror(errno));
         ret = errno;
         goto end;
     }
 
-    if (bind(sockfd, addr->ai_addr, addr->ai_addrlen) == -1) {
+    /* Every worker has its own socket, kernel distributes datagrams between them */
+    if (workers_cnt > 1 && -1 == setsockopt(worker->sockfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse))) {
+        ret = errno;
+//        log_critical("Can't enable SO_REUSEPORT on UDP socket: %s", strerror(errno));
+        goto end;
+    }
+
+    if (bind(worker->sockfd, addr->ai_addr, addr->ai_addrlen) == -1) {
         ret = errno;
 //        log_critical("Can't bind UDP socket to %s:%d: %s", hostname, ntohs(((struct sockaddr_in *)addr->ai_addr)->sin_port),
 //                     strerror(errno));
@@ -87,11 +174,47 @@ static int configure_socket() {
     return ret;
 }
 
-static void handle_incoming_datagram() {
+// resolver codes are negative, errno values are positive
+static const char *socket_error(int rv) {
+    if (EAI_SYSTEM == rv) return strerror(errno);
+
+    return rv < 0 ? gai_strerror(rv) : strerror(rv);
+}
+
+static void init_peer(snmp_peer_t *peer, const snmp_client_t *client) {
+    peer->sockfd = client->sockfd;
+    peer->addrlen = client->socklen;
+    memcpy(&peer->addr, &client->sockaddr, client->socklen);
+}
+
+/*
+ * Interrupted call and errors of single datagram, e.g. ECONNREFUSED caused by ICMP message for earlier response, leave
+ * other datagrams queued, so socket is read further. Draining stops on EAGAIN or error of socket itself.
+ */
+static bool is_receive_retried(int err) {
+    switch (err) {
+        case EINTR:
+        case ECONNREFUSED:
+        case ECONNRESET:
+        case EHOSTUNREACH:
+        case EHOSTDOWN:
+        case ENETUNREACH:
+        case ENETDOWN:
+        case ENOMEM:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// returns -1 once socket is drained, it's registered in edge-triggered mode
+static int handle_incoming_datagram(snmp_worker_t *worker) {
     ssize_t rv;
     char straddr[INET_ADDRSTRLEN] = { '\0' };
     socklen_t socklen;
     struct sockaddr_in sockaddr;
+    snmp_client_t *client = &worker->client;
+    snmp_peer_t peer;
 
     uint8_t *resp;
     ssize_t resp_size;
@@ -99,26 +222,32 @@ static void handle_incoming_datagram() {
 
     /* Read whole UDP packet from socket */
     socklen = sizeof(sockaddr);
-    rv = recvfrom(sockfd, client.packet, sizeof(client.packet), 0, (struct sockaddr *)&sockaddr, &socklen);
+    rv = recvfrom(worker->sockfd, client->packet, sizeof(client->packet), 0, (struct sockaddr *)&sockaddr, &socklen);
 
     if (rv == -1) {
 //        log_error("Failde to receive UDP packet with SNMP request: %s", strerror(errno));
-        return;
+        return is_receive_retried(errno) ? 0 : -1;
     }
 
-    client.timestamp = time(NULL);
-    client.sockfd = sockfd;
-    client.addr = sockaddr.sin_addr;
-    client.port = sockaddr.sin_port;
-    client.size = rv;
+    client->timestamp = time(NULL);
+    client->sockfd = worker->sockfd;
+    client->sockaddr = sockaddr;
+    client->socklen = socklen;
+    client->size = rv;
 
     /* Call SNMP processor what will analyse request and prepare response packet */
     inet_ntop(AF_INET, &sockaddr.sin_addr, straddr, sizeof(straddr));
 
-    resp_size = process_request(client.packet, client.size, &resp);
+    init_peer(&peer, client);
+    resp_size = process_request(&worker->arena, client->packet, client->size, worker->response,
+                                sizeof(worker->response), &resp, worker->processor, &peer);
 
+    if (resp_size < 0) {
+        // Log warning unless request is parked
+        return 0;
+    }
 
-    rv = sendto(sockfd, resp, resp_size, MSG_DONTWAIT, (struct sockaddr *)&sockaddr, socklen);
+    rv = sendto(worker->sockfd, resp, resp_size, MSG_DONTWAIT, (struct sockaddr *)&sockaddr, socklen);
     inet_ntop(AF_INET, &sockaddr.sin_addr, straddr, sizeof(straddr));
     if (rv == -1) {
         // Log warning
@@ -126,15 +255,188 @@ static void handle_incoming_datagram() {
         // Log warning
     }
 
-    free(resp);
+    return 0;
+}
+
+static int batch_init(snmp_batch_t *batch, size_t size) {
+    batch->size = size;
+    batch->clients = calloc(size, sizeof(*batch->clients));
+    batch->in_msgs = calloc(size, sizeof(*batch->in_msgs));
+    batch->in_iovs = calloc(size, sizeof(*batch->in_iovs));
+    batch->out_msgs = calloc(size, sizeof(*batch->out_msgs));
+    batch->out_iovs = calloc(size, sizeof(*batch->out_iovs));
+    batch->responses = malloc(SNMP_BATCH_BUFFER_SIZE);
+
+    if (NULL == batch->clients || NULL == batch->in_msgs || NULL == batch->in_iovs ||
+        NULL == batch->out_msgs || NULL == batch->out_iovs || NULL == batch->responses) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void batch_free(snmp_batch_t *batch) {
+    free(batch->clients);
+    free(batch->in_msgs);
+    free(batch->in_iovs);
+    free(batch->out_msgs);
+    free(batch->out_iovs);
+    free(batch->responses);
+    memset(batch, 0, sizeof(*batch));
+}
+
+// sendmmsg() can send only part of responses if socket buffer is full
+static void send_responses(snmp_worker_t *worker, int resp_cnt) {
+    int rv, sent;
+
+    for (sent = 0; sent < resp_cnt; sent += rv) {
+        if ((rv = sendmmsg(worker->sockfd, worker->batch.out_msgs + sent, resp_cnt - sent, MSG_DONTWAIT)) < 1) {
+            // Log warning, rest of responses are dropped
+            break;
+        }
+    }
+
+    worker->batch_stats.responses += sent;
 }
 
+static int handle_incoming_datagrams(snmp_worker_t *worker) {
+    int i, received, resp_cnt = 0;
+    snmp_batch_t *batch = &worker->batch;
+    snmp_client_t *cl;
+    snmp_peer_t peer;
+    uint8_t *resp, *resp_end = batch->responses + SNMP_BATCH_BUFFER_SIZE;
+    ssize_t resp_size;
+    time_t now;
+
+    for (i = 0; i < (int)batch->size; i++) {
+        cl = &batch->clients[i];
+
+        batch->in_iovs[i].iov_base = cl->packet;
+        batch->in_iovs[i].iov_len = sizeof(cl->packet);
+        batch->in_msgs[i].msg_hdr.msg_iov = &batch->in_iovs[i];
+        batch->in_msgs[i].msg_hdr.msg_iovlen = 1;
+        batch->in_msgs[i].msg_hdr.msg_name = &cl->sockaddr;
+        batch->in_msgs[i].msg_hdr.msg_namelen = sizeof(cl->sockaddr);
+    }
+
+    /* Read as many UDP packets as batch can hold with one syscall */
+    if ((received = recvmmsg(worker->sockfd, batch->in_msgs, batch->size, MSG_DONTWAIT, NULL)) < 1) {
+//        log_error("Failde to receive UDP packets with SNMP requests: %s", strerror(errno));
+        return -1 == received && is_receive_retried(errno) ? 0 : -1;
+    }
+
+    worker->batch_stats.batches++;
+    worker->batch_stats.datagrams += received;
+    if ((size_t)received == batch->size) worker->batch_stats.full_batches++;
+
+    now = time(NULL);
+
+    for (i = 0; i < received; i++) {
+        cl = &batch->clients[i];
+
+        cl->timestamp = now;
+        cl->sockfd = worker->sockfd;
+        cl->socklen = batch->in_msgs[i].msg_hdr.msg_namelen;
+        cl->size = batch->in_msgs[i].msg_len;
+        init_peer(&peer, cl);
+
+        // response is encoded from the end of its space, so responses are stacked downwards without gaps
+        if (resp_end - batch->responses < SNMP_MAX_DATAGRAM_SIZE) {
+            send_responses(worker, resp_cnt);
+            resp_cnt = 0;
+            resp_end = batch->responses + SNMP_BATCH_BUFFER_SIZE;
+        }
+
+        if ((resp_size = process_request(&worker->arena, cl->packet, cl->size, resp_end - SNMP_MAX_DATAGRAM_SIZE,
+                                         SNMP_MAX_DATAGRAM_SIZE, &resp, worker->processor, &peer)) < 0) {
+            // Log warning unless request is parked
+            continue;
+        }
+
+        resp_end = resp;
+
+        batch->out_iovs[resp_cnt].iov_base = resp;
+        batch->out_iovs[resp_cnt].iov_len = resp_size;
+        memset(&batch->out_msgs[resp_cnt], 0, sizeof(batch->out_msgs[resp_cnt]));
+        batch->out_msgs[resp_cnt].msg_hdr.msg_iov = &batch->out_iovs[resp_cnt];
+        batch->out_msgs[resp_cnt].msg_hdr.msg_iovlen = 1;
+        batch->out_msgs[resp_cnt].msg_hdr.msg_name = &cl->sockaddr;
+        batch->out_msgs[resp_cnt].msg_hdr.msg_namelen = cl->socklen;
+        resp_cnt++;
+    }
+
+    send_responses(worker, resp_cnt);
+
+    return 0;
+}
+
+// socket is registered in edge-triggered mode, so it must be drained
+static void handle_socket_event(__attribute__((unused)) event_loop_t *loop, __attribute__((unused)) int fd,
+                                __attribute__((unused)) uint32_t events, void *user_data) {
+    snmp_worker_t *worker = user_data;
+
+    if (batch_size > 1) {
+        while (0 == handle_incoming_datagrams(worker));
+    } else {
+        while (0 == handle_incoming_datagram(worker));
+    }
+}
+
+static void handle_processor_event(__attribute__((unused)) event_loop_t *loop, __attribute__((unused)) int fd,
+                                   __attribute__((unused)) uint32_t events, void *user_data) {
+    processor_complete(((snmp_worker_t *) user_data)->processor);
+}
+
+#ifdef SNMP_WITH_IO_URING
+// completions carry address of client, so parked request is answered by processor the same way as in sendto() loop
+static ssize_t handle_uring_request(void *user_data, const struct sockaddr *addr, socklen_t addrlen,
+                                    const uint8_t *req, size_t req_size, uint8_t *resp_buffer, size_t resp_buffer_size,
+                                    uint8_t **resp) {
+    snmp_worker_t *worker = user_data;
+    snmp_peer_t peer = { .sockfd = worker->sockfd, .addrlen = addrlen };
+
+    memcpy(&peer.addr, addr, addrlen);
+
+    return process_request(&worker->arena, req, req_size, resp_buffer, resp_buffer_size, resp, worker->processor,
+                           &peer);
+}
+
+static void handle_uring_event(__attribute__((unused)) event_loop_t *loop, __attribute__((unused)) int fd,
+                               __attribute__((unused)) uint32_t events, void *user_data) {
+    snmp_worker_t *worker = user_data;
+    size_t sent;
+    int received;
+
+    if ((received = uring_transport_process(worker->uring, &sent)) < 0) {
+//        log_error("Failed to process io_uring completions: %s", strerror(errno));
+        return;
+    }
+
+    if (received) worker->batch_stats.batches++;
+    worker->batch_stats.datagrams += received;
+    worker->batch_stats.responses += sent;
+}
+
+// io_uring transport must be created by thread which will use it
+static int start_uring_transport(snmp_worker_t *worker) {
+    if (NULL == (worker->uring = uring_transport_create(worker->sockfd, handle_uring_request, worker))) return -1;
+
+    if (0 != event_loop_add_fd(&worker->loop, uring_transport_fd(worker->uring), EPOLLIN, handle_uring_event,
+                               worker)) {
+        uring_transport_free(worker->uring);
+        worker->uring = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+#endif
 
-static int snmp_start() {
-    fd_set rfds;
-    struct timeval tv_timeout = { .tv_sec = 2, .tv_usec = 0 };
+static int snmp_start(snmp_worker_t *worker) {
     struct sockaddr_in sin;
     socklen_t len = sizeof(sin);
+    int sockfd = worker->sockfd;
 
     if (sockfd < 0) return 1;
 
@@ -143,197 +445,427 @@ static int snmp_start() {
         return -1;
     }
 
+    // parked requests are answered by both transports
+    if (0 != event_loop_add_fd(&worker->loop, processor_fd(worker->processor), EPOLLIN, handle_processor_event,
+                               worker)) {
+        return -1;
+    }
+
+#ifdef SNMP_WITH_IO_URING
+    // fall back to recvfrom()/sendto() loop if kernel is too old
+    if (0 == start_uring_transport(worker)) return event_loop_run(&worker->loop);
+#endif
+
+    if (0 != event_loop_add_fd(&worker->loop, sockfd, EPOLLIN, handle_socket_event, worker)) {
+//        log_critical("Can't register SNMP service socket in event loop: %s", strerror(errno));
+        return -1;
+    }
+
 //    log_info("Start listen for incomming UDP SNMP requests on 0.0.0.0:%d", ntohs(sin.sin_port));
 
-    while (!finish) {
-        FD_ZERO(&rfds);
-        FD_SET(sockfd, &rfds);
+    return event_loop_run(&worker->loop);
+}
 
-        if (select(sockfd + 1, &rfds, NULL, NULL, &tv_timeout) == -1) {
-            if (finish) break;
+// socket of failed worker stays bound and gets its share of requests, so whole agent is stopped
+static void fail_worker(snmp_worker_t *worker) {
+    worker->failed = true;
+    event_loop_stop(worker->main_loop);
+}
 
-            //TODO: Maybe EINT must be handled
-            return errno;
-        }
+static void *worker_routine(void *arg) {
+    snmp_worker_t *worker = arg;
 
-        // handle UDP packets
-        if (FD_ISSET(sockfd, &rfds)) handle_incoming_datagram();
+#ifdef SNMP_WITH_LUA
+    // every worker has its own Lua state, so handlers are called without any locks
+    if (0 != lua_handlers_attach()) {
+        fprintf(stderr, "Can't load Lua handlers: %s\n", strerror(errno));
+        fail_worker(worker);
+        return NULL;
+    }
+#endif
 
-        tv_timeout.tv_sec = 2;
-        tv_timeout.tv_usec = 0;
+    if (0 != snmp_start(worker)) {
+        fprintf(stderr, "Can't serve requests: %s\n", strerror(errno));
+        fail_worker(worker);
     }
 
-    return 0;
+#ifdef SNMP_WITH_LUA
+    lua_handlers_detach();
+#endif
+
+    return NULL;
 }
 
+static void release_workers(snmp_worker_t *workers, size_t cnt) {
+    size_t i;
 
+    for (i = 0; i < cnt; i++) {
+        // parked requests cancel their deadlines in loop
+        processor_free(workers[i].processor);
+        event_loop_free(&workers[i].loop);
+#ifdef SNMP_WITH_IO_URING
+        uring_transport_free(workers[i].uring);
+#endif
+        if (workers[i].sockfd >= 0) close(workers[i].sockfd);
 
+        batch_free(&workers[i].batch);
+        arena_free(&workers[i].arena);
+    }
 
+    free(workers);
+}
 
+static snmp_worker_t *create_workers(size_t cnt) {
+    snmp_worker_t *workers;
+    size_t i;
+    int rv;
 
+    if (NULL == (workers = calloc(cnt, sizeof(*workers)))) {
+        fprintf(stderr, "Can't start workers: %s\n", strerror(ENOMEM));
+        return NULL;
+    }
 
-int get_device_type(void **value, size_t *size, bool *is_allocated) {
-    static const oid_t oid = {.subids = { 1, 3, 6, 1, 2, 1, 25, 3, 1, 5 }, .subids_cnt = 10};
+    for (i = 0; i < cnt; i++) {
+        workers[i].sockfd = -1;
+        workers[i].loop.epfd = -1;
+        workers[i].loop.stopfd = -1;
+        workers[i].main_loop = &workers[0].loop;
+    }
 
-    *value = (void *)&oid;
-    *size = sizeof(oid);
-    *is_allocated = false;
+    for (i = 0; i < cnt; i++) {
+        if ((batch_size > 1 && 0 != batch_init(&workers[i].batch, batch_size)) ||
+            0 != event_loop_init(&workers[i].loop) ||
+            NULL == (workers[i].processor = processor_create(&workers[i].loop))) {
+            fprintf(stderr, "Can't start workers: %s\n", strerror(errno));
+            release_workers(workers, cnt);
+            return NULL;
+        }
 
-    return 0;
+        if (0 != (rv = configure_socket(&workers[i]))) {
+            fprintf(stderr, "Can't open UDP socket: %s\n", socket_error(rv));
+            release_workers(workers, cnt);
+            return NULL;
+        }
+    }
+
+    return workers;
 }
-int get_device_model(void **value, size_t *size, bool *is_allocated) {
-    static const char str[] = "MyQ Virtual Device";
 
-    *value = (void *)&str;
-    *size = sizeof(str);
-    *is_allocated = false;
+static void print_batch_stats(const snmp_worker_t *workers, size_t cnt, size_t capacity) {
+    snmp_batch_stats_t total = { 0 };
+    size_t i;
 
-    return 0;
+    for (i = 0; i < cnt; i++) {
+        total.batches += workers[i].batch_stats.batches;
+        total.datagrams += workers[i].batch_stats.datagrams;
+        total.full_batches += workers[i].batch_stats.full_batches;
+        total.responses += workers[i].batch_stats.responses;
+    }
+
+    fprintf(stderr, "Batches: %llu, datagrams: %llu, responses: %llu, full batches: %llu, average fill: %.2f/%zu\n",
+            total.batches, total.datagrams, total.responses, total.full_batches,
+            total.batches ? (double)total.datagrams / total.batches : 0.0, capacity);
 }
-int get_device_hw_addr(void **value, size_t *size, bool *is_allocated) {
-    static const uint8_t hw_addr[] = { 0x18, 0xdb, 0xf2, 0x3d, 0xde, 0x50, 0x00 };
 
-    *value = (void *)&hw_addr;
-    *size = sizeof(hw_addr);
-    *is_allocated = false;
 
-    return 0;
+int get_device_type(__attribute__((unused)) void *data, mib_value_t *value) {
+    // 1.3.6.1.2.1.25.3.1.5
+    static const uint8_t encoded[] = { 0x2B, 6, 1, 2, 1, 25, 3, 1, 5 };
+    static const oid_t oid = { .len = sizeof(encoded), .data = encoded };
+
+    return mib_value_set_oid(value, &oid);
+}
+int get_device_model(__attribute__((unused)) void *data, mib_value_t *value) {
+    static const char str[] = "MyQ Virtual Device";
+
+    return mib_value_set_bytes(value, str, sizeof(str) - 1);
+}
+int get_device_hw_addr(__attribute__((unused)) void *data, mib_value_t *value) {
+    static const uint8_t hw_addr[] = { 0x18, 0xdb, 0xf2, 0x3d, 0xde, 0x50 };
+
+    return mib_value_set_bytes(value, hw_addr, sizeof(hw_addr));
 }
-int get_device_sn(void **value, size_t *size, bool *is_allocated) {
+int get_device_sn(__attribute__((unused)) void *data, mib_value_t *value) {
     static const char str[] = "SN2W443554";
 
-    *value = (void *)&str;
-    *size = sizeof(str);
-    *is_allocated = false;
+    return mib_value_set_bytes(value, str, sizeof(str) - 1);
+}
 
-    return 0;
+int get_c1(__attribute__((unused)) void *data, mib_value_t *value) {
+    return mib_value_set_integer(value, 200);
 }
 
-int get_c1(void **value, size_t *size, bool *is_allocated) {
-    static const int cnt = 200;
+int get_c2(__attribute__((unused)) void *data, mib_value_t *value) {
+    return mib_value_set_integer(value, 200);
+}
 
-    *value = (void *)&cnt;
-    *size = sizeof(cnt);
-    *is_allocated = false;
+// columns of printer supplies table, rows are indexed by device and supply, device 1 has 4 supplies
+#define SUPPLIES_CNT 4
 
-    return 0;
+bool supply_exists(__attribute__((unused)) void *data, const mib_instance_t *instance) {
+    return 2 == instance->len && 1 == instance->arcs[0] && instance->arcs[1] >= 1 &&
+           instance->arcs[1] <= SUPPLIES_CNT;
 }
 
-int get_c2(void **value, size_t *size, bool *is_allocated) {
-    static const int cnt = 200;
+bool supply_next(__attribute__((unused)) void *data, const mib_instance_t *instance, mib_instance_t *next) {
+    next->len = 2;
+    next->arcs[0] = 1;
+    next->arcs[1] = 1;
 
-    *value = (void *)&cnt;
-    *size = sizeof(cnt);
-    *is_allocated = false;
+    if (0 == instance->len || 0 == instance->arcs[0] || (1 == instance->arcs[0] && 1 == instance->len)) return true;
+    if (instance->arcs[0] > 1 || instance->arcs[1] >= SUPPLIES_CNT) return false;
 
-    return 0;
+    next->arcs[1] = instance->arcs[1] + 1;
+    return true;
 }
 
-int get_c3(void **value, size_t *size, bool *is_allocated) {
-    static const int cnt = 50;
+int get_supplies_level(__attribute__((unused)) void *data, __attribute__((unused)) const mib_instance_t *instance,
+                       mib_value_t *value) {
+    return mib_value_set_integer(value, 50);
+}
 
-    *value = (void *)&cnt;
-    *size = sizeof(cnt);
-    *is_allocated = false;
+int get_supplies_max_capacity(__attribute__((unused)) void *data,
+                              __attribute__((unused)) const mib_instance_t *instance, mib_value_t *value) {
+    return mib_value_set_integer(value, 100);
+}
 
-    return 0;
+// referenced by generated MIB table
+const mib_subtree_t supplies_level = {
+        .exists = supply_exists, .next = supply_next, .get_value = get_supplies_level
+};
+const mib_subtree_t supplies_max_capacity = {
+        .exists = supply_exists, .next = supply_next, .get_value = get_supplies_max_capacity
+};
+
+
+
+// termination signal received by main thread stops loops of all workers
+static void handle_signal(__attribute__((unused)) event_loop_t *loop, int fd,
+                          __attribute__((unused)) uint32_t events, void *user_data) {
+    snmp_worker_t *workers = user_data;
+    struct signalfd_siginfo info;
+    size_t i;
+
+    while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+        for (i = 0; i < workers_cnt; i++) event_loop_stop(&workers[i].loop);
+    }
 }
 
-int get_c4(void **value, size_t *size, bool *is_allocated) {
-    static const int cnt = 100;
+static void print_usage(const char *prog) {
+    printf("Usage: %s [options]\n"
+           "    -b, --batch-size NUMBER\n"
+           "      Amount of UDP datagrams received and answered with single system call, default is 1.\n"
+           "    -C, --cache OID=TTL[/SWR]\n"
+           "      Serve values of subtree from cache for TTL milliseconds, and stale ones for SWR more while they are\n"
+           "      refreshed in background. Can be given several times.\n"
+           "    -d, --scripts-dir DIR\n"
+           "      Directory with scripts handling custom OIDs.\n"
+           "    -D, --discovery-cache FILE\n"
+           "      Keep OIDs and types reported by scripts in FILE, unchanged scripts aren't asked again on next start.\n"
+           "    -h, --help\n"
+           "      Show summary of command line options and exit.\n"
+           "    -S, --slow-threads NUMBER\n"
+           "      Amount of threads running slow handlers, default is %d, 0 runs them by workers.\n"
+           "    -T, --deadline [OID=]MS\n"
+           "      Time value is waited for before it's reported as missing, default is %d for whole request. With OID\n"
+           "      applies to values of subtree, can be given several times.\n"
+           "    -w, --workers NUMBER\n"
+           "      Amount of threads serving requests, each with its own socket, default is 1.\n", prog,
+           SNMP_POOL_THREADS, SNMP_DEADLINE_REQUEST_MS);
+}
 
-    *value = (void *)&cnt;
-    *size = sizeof(cnt);
-    *is_allocated = false;
+static int parse_options(int argc, char *argv[]) {
+    static const struct option options[] = {
+            { "batch-size",      required_argument, NULL, 'b' },
+            { "cache",           required_argument, NULL, 'C' },
+            { "scripts-dir",     required_argument, NULL, 'd' },
+            { "discovery-cache", required_argument, NULL, 'D' },
+            { "help",            no_argument,       NULL, 'h' },
+            { "slow-threads",    required_argument, NULL, 'S' },
+            { "deadline",        required_argument, NULL, 'T' },
+            { "workers",         required_argument, NULL, 'w' },
+            { NULL,              0,                 NULL, 0 }
+    };
+    char *end;
+    long val;
+    int opt;
+
+    while (-1 != (opt = getopt_long(argc, argv, "b:C:d:D:hS:T:w:", options, NULL))) {
+        switch (opt) {
+            case 'b':
+                val = strtol(optarg, &end, 10);
+                if ('\0' != *end || val < 1 || val > SNMP_BATCH_SIZE_MAX) {
+                    fprintf(stderr, "Batch size must be in range 1..%d\n", SNMP_BATCH_SIZE_MAX);
+                    return -1;
+                }
+                batch_size = (size_t)val;
+                break;
+            case 'C':
+                if (0 != cache_add_rule(optarg)) {
+                    fprintf(stderr, "Cache rule must look like OID=TTL[/SWR]: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'd':
+                scripts_dir = optarg;
+                break;
+            case 'D':
+                discovery_cache = optarg;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                exit(EXIT_SUCCESS);
+            case 'S':
+                val = strtol(optarg, &end, 10);
+                if ('\0' != *end || val < 0 || val > SNMP_WORKERS_MAX) {
+                    fprintf(stderr, "Amount of slow handler threads must be in range 0..%d\n", SNMP_WORKERS_MAX);
+                    return -1;
+                }
+                slow_threads = (size_t)val;
+                break;
+            case 'T':
+                if (0 != deadline_add_rule(optarg)) {
+                    fprintf(stderr, "Deadline must look like [OID=]MS: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'w':
+                val = strtol(optarg, &end, 10);
+                if ('\0' != *end || val < 1 || val > SNMP_WORKERS_MAX) {
+                    fprintf(stderr, "Amount of workers must be in range 1..%d\n", SNMP_WORKERS_MAX);
+                    return -1;
+                }
+                workers_cnt = (size_t)val;
+                break;
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
 
     return 0;
 }
 
+int main(int argc, char *argv[]) {
+    sigset_t sigmask;
+    int sigfd = -1, rv = EXIT_FAILURE, err;
+    snmp_worker_t *workers = NULL;
+    size_t i, started = 0;
+    // built-in MIB is generated from mib.def and is served right from read-only memory
+    if (0 != mib_add_table(mib_table, mib_table_cnt)) {
+        fprintf(stderr, "Can't register built-in OIDs: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
 
+    if (0 != parse_options(argc, argv)) goto end;
 
-int main() {
-    oid_t hw_info = {
-            .subids = { 1, 3, 6, 1, 2, 1, 25, 3, 2, 1, 2, 2 },
-            .subids_cnt = 12
-    }, model = {
-            .subids = { 1, 3, 6, 1, 2, 1, 25, 3, 2, 1, 3, 1 } ,
-            .subids_cnt = 12
-    }, hw_addr = {
-            .subids = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 6, 1 },
-            .subids_cnt = 11
-    }, sn = {
-            .subids = { 1, 3, 6, 1, 2, 1, 43,   5,  1, 1,  17, 1},
-            .subids_cnt = 12
-    }, c1_1 = {
-            .subids = { 1, 3, 6, 1, 4, 1, 11, 2, 3, 9, 4, 2, 1, 1, 16, 1, 44, 1, 2 },
-            .subids_cnt = 19
-    }, c1_2 = {
-            .subids = { 1, 3, 6, 1, 4, 1, 11, 2, 3, 9, 4, 2, 1, 1, 16, 1, 44, 2, 1 },
-            .subids_cnt = 17
-    }, c1_3 = {
-            .subids = { 1, 3, 6, 1, 4, 1, 11, 2, 3, 9, 4, 2, 1, 1, 16, 1, 44, 2, 2 },
-            .subids_cnt = 19
-    }, c1_4 = {
-            .subids = { 1, 3, 6, 1, 4, 1, 11, 2, 3, 9, 4, 2, 1, 1, 16, 1, 44, 1, 3 },
-            .subids_cnt = 19
-    }, c2_1 = {
-            .subids = { 1, 3, 6, 1, 4, 1, 11, 2, 3, 9, 4, 2, 1, 2, 2, 1, 62 },
-            .subids_cnt = 17
-    }, c3_1 = {
-            .subids = { 1, 3, 6, 1, 2, 1, 43, 11,1, 1, 9, 1, 1 },
-            .subids_cnt = 13
-    }, c3_2 = {
-            .subids = { 1, 3, 6, 1, 2, 1, 43, 11,1, 1, 9, 1, 2 },
-            .subids_cnt = 13
-    }, c3_3 = {
-            .subids = { 1, 3, 6, 1, 2, 1, 43, 11,1, 1, 9, 1, 3 },
-            .subids_cnt = 13
-    }, c3_4 = {
-            .subids = { 1, 3, 6, 1, 2, 1, 43, 11,1, 1, 9, 1, 4 },
-            .subids_cnt = 13
-    }, c4_1 = {
-            .subids = { 1, 3, 6, 1, 2, 1, 43, 11,1, 1, 8, 1, 1 },
-            .subids_cnt = 13
-    }, c4_2 = {
-            .subids = { 1, 3, 6, 1, 2, 1, 43, 11,1, 1, 8, 1, 2 },
-            .subids_cnt = 13
-    }, c4_3 = {
-            .subids = { 1, 3, 6, 1, 2, 1, 43, 11,1, 1, 8, 1 ,3 },
-            .subids_cnt = 13
-    }, c4_4 = {
-            .subids = { 1, 3, 6, 1, 2, 1, 43, 11,1, 1, 8, 1, 4 },
-            .subids_cnt = 13
-    };
+    // signals are delivered only through signalfd, blocked mask is inherited by all workers and helper threads
+    sigemptyset(&sigmask);
+    sigaddset(&sigmask, SIGINT);
+    sigaddset(&sigmask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigmask, NULL);
+
+    if (NULL != scripts_dir && scripts_load(scripts_dir, discovery_cache) < 0) {
+        fprintf(stderr, "Can't load scripts from %s: %s\n", scripts_dir, strerror(errno));
+        goto end;
+    }
+
+#ifdef SNMP_WITH_LUA
+    if (NULL != scripts_dir && lua_handlers_load(scripts_dir) < 0) {
+        fprintf(stderr, "Can't load Lua scripts from %s: %s\n", scripts_dir, strerror(errno));
+        goto end;
+    }
+#endif
+
+    if (0 != mib_build_index()) {
+        fprintf(stderr, "Can't build MIB index: %s\n", EEXIST == errno ? "conflicting handlers" : strerror(errno));
+        goto end;
+    }
+
+    if (0 != deadline_start()) {
+        fprintf(stderr, "Can't apply deadlines: %s\n", strerror(errno));
+        goto end;
+    }
+
+#ifdef SNMP_WITH_LUA
+    if (0 != cache_start(lua_handlers_attach, lua_handlers_detach)) {
+#else
+    if (0 != cache_start(NULL, NULL)) {
+#endif
+        fprintf(stderr, "Can't start cache: %s\n", strerror(errno));
+        goto end;
+    }
+
+#ifdef SNMP_WITH_LUA
+    if (0 != pool_start(slow_threads, lua_handlers_attach, lua_handlers_detach)) {
+#else
+    if (0 != pool_start(slow_threads, NULL, NULL)) {
+#endif
+        fprintf(stderr, "Can't start slow handler threads: %s\n", strerror(errno));
+        goto end;
+    }
 
+    // reason is reported by create_workers()
+    if (NULL == (workers = create_workers(workers_cnt))) goto end;
 
-    mib_add_entry(&hw_info, OBJECT_TYPE_OID, get_device_type, NULL);
-    mib_add_entry(&model, OBJECT_TYPE_OCTET_STRING, get_device_model, NULL);
-    mib_add_entry(&hw_addr, OBJECT_TYPE_OCTET_STRING, get_device_hw_addr, NULL);
-    mib_add_entry(&sn, OBJECT_TYPE_OCTET_STRING, get_device_sn, NULL);
+    if (-1 == (sigfd = signalfd(-1, &sigmask, SFD_NONBLOCK | SFD_CLOEXEC)) ||
+        0 != event_loop_add_fd(&workers[0].loop, sigfd, EPOLLIN, handle_signal, workers)) {
+        fprintf(stderr, "Can't handle termination signals: %s\n", strerror(errno));
+        goto end;
+    }
+
+    // MIB is complete at this point and is only read by workers, first worker is served by main thread
+    for (i = 1; i < workers_cnt; i++) {
+        if (0 != (err = pthread_create(&workers[i].thread, NULL, worker_routine, &workers[i]))) {
+            fprintf(stderr, "Can't start worker: %s\n", strerror(err));
+            break;
+        }
+
+        started++;
+    }
 
-    mib_add_entry(&c1_1, OBJECT_TYPE_INTEGER, get_c1, NULL);
-    mib_add_entry(&c1_2, OBJECT_TYPE_INTEGER, get_c1, NULL);
-    mib_add_entry(&c1_3, OBJECT_TYPE_INTEGER, get_c1, NULL);
-    mib_add_entry(&c1_4, OBJECT_TYPE_INTEGER, get_c1, NULL);
+    // kernel keeps sending share of requests to every bound socket, so agent doesn't run without some of workers
+    if (started + 1 == workers_cnt) worker_routine(&workers[0]);
 
-    mib_add_entry(&c2_1, OBJECT_TYPE_INTEGER, get_c2, NULL);
+    // loop of main thread can also finish because of error
+    for (i = 1; i <= started; i++) {
+        event_loop_stop(&workers[i].loop);
+        pthread_join(workers[i].thread, NULL);
+    }
 
-    mib_add_entry(&c3_1, OBJECT_TYPE_INTEGER, get_c3, NULL);
-    mib_add_entry(&c3_2, OBJECT_TYPE_INTEGER, get_c3, NULL);
-    mib_add_entry(&c3_3, OBJECT_TYPE_INTEGER, get_c3, NULL);
-    mib_add_entry(&c3_4, OBJECT_TYPE_INTEGER, get_c3, NULL);
+    if (started + 1 != workers_cnt) goto end;
 
-    mib_add_entry(&c4_1, OBJECT_TYPE_INTEGER, get_c4, NULL);
-    mib_add_entry(&c4_2, OBJECT_TYPE_INTEGER, get_c4, NULL);
-    mib_add_entry(&c4_3, OBJECT_TYPE_INTEGER, get_c4, NULL);
-    mib_add_entry(&c4_4, OBJECT_TYPE_INTEGER, get_c4, NULL);
+    for (i = 0; i < workers_cnt; i++) {
+        if (workers[i].failed) goto end;
+    }
 
-    if (!configure_socket()) {
-        snmp_start();
+#ifdef SNMP_WITH_IO_URING
+    // every completion reaping is counted as a batch, its capacity is number of provided buffers
+    if (NULL != workers[0].uring) {
+        print_batch_stats(workers, workers_cnt, SNMP_URING_DEPTH);
+    } else
+#endif
+    if (batch_size > 1) {
+        print_batch_stats(workers, workers_cnt, batch_size);
     }
 
+    cache_print_stats();
+    pool_print_stats();
+    deadline_print_stats();
+    rv = EXIT_SUCCESS;
 
+    end:
+    if (-1 != sigfd) close(sigfd);
+    // asynchronous getters in flight are completed into processors of workers
+    pool_free();
+    cache_free();
+    scripts_free();
+    if (NULL != workers) release_workers(workers, workers_cnt);
+    deadline_free();
+#ifdef SNMP_WITH_LUA
+    lua_handlers_free();
+#endif
     mib_free();
 
-    return 0;
+    return rv;
 }
@@ -17,130 +17,682 @@
  */
 
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <limits.h>
 #include <memory.h>
+#include <errno.h>
 #include <stdio.h>
+#include <time.h>
 
 #include "mib.h"
 #include "utilities.h"
 
-typedef struct mib_tree_node mib_tree_node_t;
+// slot of hash table, position 0 means empty slot, so positions are counted from 1
+typedef struct mib_slot {
+    uint32_t hash;
+    uint32_t pos;
+} mib_slot_t;
 
-struct mib_tree_node {
-    int32_t subid;
+/*
+ * MIB is stored as flat array of entries sorted by OID in lexicographic order. Entries registered before
+ * mib_build_index() are only appended, so bulk registration doesn't pay for keeping array sorted on every insert.
+ *
+ * GET is served by open addressing hash table over encoded OIDs, which finds entry in a single probe mostly, while
+ * binary search compares OIDs at every step. Sorted array is still used by GETNEXT and for instances of subtrees.
+ */
+typedef struct mib_index {
+    mib_entry_t *entries;
+    size_t entries_cnt;
+    size_t entries_cap;
+    bool is_sorted;                             // entries are appended in order, so sorting can be skipped
+    bool is_built;                              // index is built, single entries are inserted in their places
+    bool is_readonly;                           // entries are generated table, it's copied before the first change
+    arena_t oids;                               // encoded OIDs of entries
+    mib_slot_t *slots;                          // hash table of entries, NULL until index is built
+    size_t slots_mask;                          // number of slots is power of 2, at least twice more than entries
+    size_t subtrees_cnt;
+    atomic_uint *latency_us;                    // average latency of getters, parallel to entries
+} mib_index_t;
+
+static mib_index_t mib = {
+        .is_sorted = true,
+};
 
-    size_t childs_cnt;
-    mib_tree_node_t **childs;
+// stable merge sort, so the first registered entry goes first among duplicates
+static int sort_entries() {
+    mib_entry_t *tmp, *src = mib.entries, *dst, *swap;
+    size_t width, lo, mid, hi, i, j, k;
+
+    if (NULL == (tmp = malloc(mib.entries_cnt * sizeof(*tmp)))) return -1;
+    dst = tmp;
+
+    for (width = 1; width < mib.entries_cnt; width *= 2) {
+        for (lo = 0; lo < mib.entries_cnt; lo += 2 * width) {
+            mid = lo + width < mib.entries_cnt ? lo + width : mib.entries_cnt;
+            hi = mid + width < mib.entries_cnt ? mid + width : mib.entries_cnt;
+
+            for (i = lo, j = mid, k = lo; k < hi; k++) {
+                if (i < mid && (j == hi || oid_compare(&src[i].oid, &src[j].oid) <= 0)) {
+                    dst[k] = src[i++];
+                } else {
+                    dst[k] = src[j++];
+                }
+            }
+        }
 
-    mib_entry_t entry;
-};
+        swap = src;
+        src = dst;
+        dst = swap;
+    }
 
-static mib_tree_node_t mib = {
-        .subid = 1,
-};
+    if (src != mib.entries) {
+        memcpy(mib.entries, src, mib.entries_cnt * sizeof(*mib.entries));
+    }
 
-static int comparator(const void *a, const void *b) {
-    return (*((const mib_tree_node_t **)a))->subid - (*((const mib_tree_node_t **)b))->subid;
-}
+    free(tmp);
 
-int mib_add_entry(const oid_t *oid, object_type_t type, mib_getter_t getter,
-                  mib_setter_t setter) {
-    mib_tree_node_t *node = &mib, *subnode, key, *key_ptr;
-    size_t i;
-    bool found = true;
+    return 0;
+}
 
-    key_ptr = &key;
+// returns position of first entry which OID is not less (or greater when strict is true) than given one
+static size_t lower_bound(const oid_t *oid, bool strict) {
+    size_t lo = 0, hi = mib.entries_cnt, mid;
+    int res;
 
-    for (i = 1; i < oid->subids_cnt; i++) {
-        key.subid = oid->subids[i];
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        res = oid_compare(&mib.entries[mid].oid, oid);
 
-        if (NULL == (subnode = bsearch(&key_ptr, node->childs, node->childs_cnt, sizeof(*node->childs), comparator))) {
-            found = false;
-            break;
+        if (res < 0 || (strict && 0 == res)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
+    }
+
+    return lo;
+}
+
+static int reserve(size_t cnt) {
+    size_t cap = mib.entries_cap ? mib.entries_cap : 64;
+    mib_entry_t *entries;
+
+    if (cnt <= mib.entries_cap && !mib.is_readonly) return 0;
 
-        node = *(mib_tree_node_t **)subnode;
+    while (cap < cnt) cap *= 2;
+
+    if (mib.is_readonly) {
+        if (NULL == (entries = malloc(cap * sizeof(*entries)))) return -1;
+
+        memcpy(entries, mib.entries, mib.entries_cnt * sizeof(*entries));
+        mib.is_readonly = false;
+    } else if (NULL == (entries = realloc(mib.entries, cap * sizeof(*entries)))) {
+        return -1;
     }
 
-    if (!found) {
-        for (; i < oid->subids_cnt; i++) {
+    mib.entries = entries;
+    mib.entries_cap = cap;
+
+    return 0;
+}
 
-            subnode = malloc(sizeof(*subnode));
+// positions of entries are changed by every insert, so table and measured latencies are built anew
+static int build_slots() {
+    size_t cap = 16, i, j;
+    mib_slot_t *slots;
+    uint32_t hash;
 
-            node->childs = realloc(node->childs, (node->childs_cnt + 1) * sizeof(*node->childs));
-            node->childs[node->childs_cnt++] = subnode;
+    while (cap < 2 * mib.entries_cnt) cap *= 2;
 
-            subnode->subid = oid->subids[i];
+    // stale table must not be left on failure, lookups fall back to binary search without it
+    free(mib.slots);
+    free(mib.latency_us);
+    mib.slots = NULL;
+    mib.latency_us = NULL;
 
-            qsort(node->childs, node->childs_cnt, sizeof(*node->childs), comparator);
+    if (mib.entries_cnt >= UINT32_MAX) {
+        errno = EOVERFLOW;
+        return -1;
+    }
 
-            node = subnode;
-        }
+    if (NULL == (mib.latency_us = calloc(mib.entries_cnt + 1, sizeof(*mib.latency_us))) ||
+        NULL == (slots = calloc(cap, sizeof(*slots)))) {
+        return -1;
+    }
+
+    mib.slots = slots;
+    mib.slots_mask = cap - 1;
+    mib.subtrees_cnt = 0;
+
+    for (i = 0; i < mib.entries_cnt; i++) {
+        hash = oid_hash(&mib.entries[i].oid);
+
+        for (j = hash & mib.slots_mask; slots[j].pos; j = (j + 1) & mib.slots_mask);
 
-        node->entry.type = type;
-        node->entry.get = getter;
-        node->entry.set = setter;
-        memmove(&node->entry.oid, oid, sizeof(node->entry.oid));
+        slots[j].hash = hash;
+        slots[j].pos = (uint32_t) i + 1;
+
+        if (NULL != mib.entries[i].subtree) mib.subtrees_cnt++;
     }
 
-    return found;
+    return 0;
 }
 
-const mib_entry_t *mib_find(const oid_t *oid) {
-    mib_tree_node_t *node = &mib, *subnode, key, *key_ptr;
-    size_t i;
+// returns entry which OID is equal to given one
+static const mib_entry_t *find_exact(const oid_t *oid) {
+    const mib_entry_t *entry;
+    uint32_t hash;
+    size_t i, pos;
 
-    key_ptr = &key;
+    if (NULL == mib.slots) {
+        pos = lower_bound(oid, false);
+        return pos < mib.entries_cnt && 0 == oid_compare(&mib.entries[pos].oid, oid) ? &mib.entries[pos] : NULL;
+    }
 
-    for (i = 1; i < oid->subids_cnt; i++) {
-        key.subid = oid->subids[i];
+    hash = oid_hash(oid);
 
-        if (NULL == (subnode = bsearch(&key_ptr, node->childs, node->childs_cnt, sizeof(*node->childs), comparator))) {
-            return NULL;
+    for (i = hash & mib.slots_mask; mib.slots[i].pos; i = (i + 1) & mib.slots_mask) {
+        if (mib.slots[i].hash != hash) continue;
+
+        entry = &mib.entries[mib.slots[i].pos - 1];
+        if (entry->oid.len == oid->len && 0 == memcmp(entry->oid.data, oid->data, oid->len)) return entry;
+    }
+
+    return NULL;
+}
+
+// entries inside of subtree can't be served, instances of subtree are
+static inline bool is_in_subtree_entry(const oid_t *oid, const mib_entry_t *entry) {
+    return NULL != entry->subtree && oid_is_in_subtree(oid, &entry->oid);
+}
+
+// OID of entry is copied into MIB
+static int add_entry(const mib_entry_t *src) {
+    size_t pos = mib.entries_cnt;
+    const oid_t *oid = &src->oid;
+    mib_entry_t *entry;
+    uint8_t *oid_data;
+
+    if (mib.is_built && mib.entries_cnt) {
+        pos = lower_bound(oid, false);
+
+        if (pos < mib.entries_cnt && 0 == oid_compare(&mib.entries[pos].oid, oid)) return true;
+        if (pos && is_in_subtree_entry(oid, &mib.entries[pos - 1])) return true;
+        if (NULL != src->subtree && pos < mib.entries_cnt && oid_is_in_subtree(&mib.entries[pos].oid, oid)) {
+            return true;
         }
+    }
+
+    if (reserve(mib.entries_cnt + 1) < 0 || NULL == (oid_data = arena_memdup(&mib.oids, oid->data, oid->len))) {
+        return -1;
+    }
 
-        node = *(mib_tree_node_t **)subnode;
+    if (pos < mib.entries_cnt) {
+        memmove(&mib.entries[pos + 1], &mib.entries[pos], (mib.entries_cnt - pos) * sizeof(*mib.entries));
+    } else if (pos && mib.is_sorted) {
+        mib.is_sorted = 0 < oid_compare(oid, &mib.entries[pos - 1].oid) &&
+                        !is_in_subtree_entry(oid, &mib.entries[pos - 1]);
     }
 
-    return node->childs_cnt ? NULL : &node->entry;
+    entry = &mib.entries[pos];
+    *entry = *src;
+    entry->oid.data = oid_data;
+    entry->cache = NULL;
+    entry->instance = NULL;
+
+    mib.entries_cnt++;
+
+    if (mib.is_built && build_slots() < 0) return -1;
+
+    return false;
+}
+
+int mib_add_entry(const oid_t *oid, object_type_t type, mib_getter_t getter,
+                  mib_setter_t setter, void *data) {
+    const mib_entry_t entry = { .oid = *oid, .type = type, .get = getter, .set = setter, .data = data };
+
+    return add_entry(&entry);
+}
+
+int mib_add_value_entry(const oid_t *oid, object_type_t type, mib_value_getter_t getter, mib_setter_t setter,
+                        void *data) {
+    const mib_entry_t entry = { .oid = *oid, .type = type, .get_value = getter, .set = setter, .data = data };
+
+    return add_entry(&entry);
+}
+
+int mib_add_subtree(const oid_t *oid, object_type_t type, const mib_subtree_t *subtree, void *data) {
+    const mib_entry_t entry = { .oid = *oid, .type = type, .subtree = subtree, .data = data };
+
+    return add_entry(&entry);
 }
 
-const mib_entry_t *mib_findnext(const oid_t *oid) {
-    mib_tree_node_t *node = &mib, *subnode, key, *key_ptr;
+int mib_add_entries(const mib_entry_t *entries, size_t cnt) {
     size_t i;
-    key_ptr = &key;
 
-    for (i = 1; i < oid->subids_cnt; i++) {
-        key.subid = oid->subids[i];
+    if (reserve(mib.entries_cnt + cnt) < 0) return -1;
 
-        if (NULL == (subnode = bsearch(&key_ptr, node->childs, node->childs_cnt, sizeof(void *), comparator))) {
-            break;
+    // index is rebuilt as a whole, it's cheaper than inserting every entry into its place
+    mib.is_built = false;
+    free(mib.slots);
+    free(mib.latency_us);
+    mib.slots = NULL;
+    mib.latency_us = NULL;
+
+    for (i = 0; i < cnt; i++) {
+        if (add_entry(&entries[i]) < 0) return -1;
+    }
+
+    return 0;
+}
+
+int mib_add_table(const mib_entry_t *entries, size_t cnt) {
+    if (0 != mib.entries_cnt) return mib_add_entries(entries, cnt);
+
+    // OIDs of generated table are static too, so table is used as it is
+    mib.entries = (mib_entry_t *) entries;
+    mib.entries_cnt = cnt;
+    mib.entries_cap = 0;
+    mib.is_readonly = mib.is_sorted = mib.is_built = true;
+
+    return build_slots();
+}
+
+static void report_conflict(const mib_entry_t *kept, const mib_entry_t *dropped) {
+    char *oid_str = oid_to_string(&dropped->oid);
+
+    fprintf(stderr, "OID %s handled by %s is %s %s\n", NULL != oid_str ? oid_str : "?",
+            NULL != dropped->origin ? dropped->origin : "built-in handler",
+            0 == oid_compare(&kept->oid, &dropped->oid) ? "already handled by" : "inside of subtree handled by",
+            NULL != kept->origin ? kept->origin : "built-in handler");
+
+    free(oid_str);
+}
+
+int mib_build_index() {
+    size_t i, cnt = 0;
+
+    if (mib.is_built) return 0;
+
+    if (!mib.is_sorted && sort_entries() < 0) return -1;
+
+    // conflicting entries are reported and dropped, first registered entry is kept
+    for (i = 0; i < mib.entries_cnt; i++) {
+        if (cnt && (0 == oid_compare(&mib.entries[cnt - 1].oid, &mib.entries[i].oid) ||
+                    is_in_subtree_entry(&mib.entries[i].oid, &mib.entries[cnt - 1]))) {
+            report_conflict(&mib.entries[cnt - 1], &mib.entries[i]);
+            continue;
+        }
+
+        if (cnt != i) {
+            mib.entries[cnt] = mib.entries[i];
         }
+        cnt++;
+    }
+
+    i = mib.entries_cnt - cnt;
+    mib.entries_cnt = cnt;
+    mib.is_sorted = mib.is_built = true;
+
+    if (build_slots() < 0) return -1;
 
-        node = *(mib_tree_node_t **)subnode;
+    if (i) {
+        errno = EEXIST;
+        return -1;
     }
 
-    while (node->childs_cnt) {
-        node = *node->childs;
+    return 0;
+}
+
+// splits OID inside of subtree into instance, returns false if instance has too many arcs
+static bool get_instance(const mib_entry_t *subtree, const oid_t *oid, mib_instance_t *instance) {
+    size_t cnt = ber_decode_arcs(oid->data + subtree->oid.len, oid->len - subtree->oid.len, instance->arcs,
+                                 SNMP_MIB_INSTANCE_LEN_MAX);
+
+    instance->len = cnt < SNMP_MIB_INSTANCE_LEN_MAX ? cnt : SNMP_MIB_INSTANCE_LEN_MAX;
+
+    return cnt <= SNMP_MIB_INSTANCE_LEN_MAX;
+}
+
+static int compare_instances(const mib_instance_t *a, const mib_instance_t *b) {
+    size_t i, len = a->len < b->len ? a->len : b->len;
+
+    for (i = 0; i < len; i++) {
+        if (a->arcs[i] != b->arcs[i]) return a->arcs[i] < b->arcs[i] ? -1 : 1;
     }
 
-    return &node->entry;
+    return (a->len > b->len) - (a->len < b->len);
 }
 
-static void free_mib_node(mib_tree_node_t *node) {
-    size_t i;
-    for (i = 0; i < node->childs_cnt; i++) {
-        free_mib_node(node->childs[i]);
-        free(node->childs);
+// entry of instance is a copy of subtree entry, OID is encoded only if it isn't given
+static const mib_entry_t *create_instance_entry(arena_t *arena, const mib_entry_t *subtree,
+                                                const mib_instance_t *instance, const oid_t *oid) {
+    mib_entry_t *entry;
+    mib_instance_t *instance_copy;
+    size_t len;
+    uint8_t *data;
+
+    if (NULL == (entry = arena_alloc(arena, sizeof(*entry))) ||
+        NULL == (instance_copy = arena_memdup(arena, instance, sizeof(*instance)))) {
+        return NULL;
     }
 
-    free(node);
+    *entry = *subtree;
+    entry->instance = instance_copy;
+
+    if (NULL != oid) {
+        entry->oid = *oid;
+        return entry;
+    }
+
+    len = ber_calc_encoded_arcs_len(instance->arcs, instance->len);
+    if (NULL == (data = arena_alloc(arena, subtree->oid.len + len))) return NULL;
+
+    memcpy(data, subtree->oid.data, subtree->oid.len);
+    ber_encode_arcs(instance->arcs, instance->len, data + subtree->oid.len);
+
+    entry->oid.data = data;
+    entry->oid.len = subtree->oid.len + len;
+
+    return entry;
 }
 
-void mib_free() {
+// handler must move forward, otherwise walk of MIB would never end
+static const mib_entry_t *find_next_instance(arena_t *arena, const mib_entry_t *subtree,
+                                             const mib_instance_t *instance) {
+    mib_instance_t next;
+
+    if (!subtree->subtree->next(subtree->data, instance, &next) || 0 == next.len ||
+        next.len > SNMP_MIB_INSTANCE_LEN_MAX || compare_instances(&next, instance) <= 0) {
+        return NULL;
+    }
+
+    return create_instance_entry(arena, subtree, &next, NULL);
+}
+
+const mib_entry_t *mib_find(arena_t *arena, const oid_t *oid) {
+    const mib_entry_t *entry = find_exact(oid);
+    mib_instance_t instance;
+    size_t pos;
+
+    if (NULL != entry) return NULL == entry->subtree ? entry : NULL;
+
+    // subtree instances need ordered search, without subtrees it's a miss already
+    if (NULL != mib.slots && 0 == mib.subtrees_cnt) return NULL;
+
+    pos = lower_bound(oid, false);
+
+    // there are no entries inside of subtree, so OID can only be an instance of previous entry
+    if (0 == pos || !is_in_subtree_entry(oid, entry = &mib.entries[pos - 1])) return NULL;
+
+    if (!get_instance(entry, oid, &instance) || !entry->subtree->exists(entry->data, &instance)) return NULL;
+
+    return create_instance_entry(arena, entry, &instance, oid);
+}
+
+const mib_entry_t *mib_findnext(arena_t *arena, const oid_t *oid) {
+    size_t pos = lower_bound(oid, true);
+    const mib_entry_t *entry;
+    mib_instance_t instance;
+
+    /*
+     * OID is inside of subtree or is subtree itself. Instance is truncated if it's too long, instances can't be
+     * longer, so the next one after truncated instance is the next one after original too.
+     */
+    if (pos && is_in_subtree_entry(oid, &mib.entries[pos - 1])) {
+        get_instance(&mib.entries[pos - 1], oid, &instance);
+
+        if (NULL != (entry = find_next_instance(arena, &mib.entries[pos - 1], &instance))) return entry;
+    }
+
+    // empty subtrees are skipped
+    for (instance.len = 0; pos < mib.entries_cnt; pos++) {
+        if (NULL == mib.entries[pos].subtree) return &mib.entries[pos];
+
+        if (NULL != (entry = find_next_instance(arena, &mib.entries[pos], &instance))) return entry;
+    }
+
+    return NULL;
+}
+
+static bool is_unsigned_type(object_type_t type) {
+    return OBJECT_TYPE_COUNTER == type || OBJECT_TYPE_GAUGE == type || OBJECT_TYPE_TIMETICKS == type ||
+           OBJECT_TYPE_COUNTER64 == type;
+}
+
+static inline int set_value(mib_value_t *value, void *data, size_t size) {
+    value->data = data;
+    value->size = size;
+    value->is_set = true;
+
+    return 0;
+}
+
+int mib_value_set_integer(mib_value_t *value, int64_t val) {
+    size_t size = ber_calc_encoded_int64_len(&val);
+    uint8_t *data;
+
+    if (OBJECT_TYPE_INTEGER != value->type || val < INT32_MIN || val > INT32_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (NULL == (data = arena_alloc(value->arena, size))) return -1;
+    ber_encode_int64(&val, data);
+
+    return set_value(value, data, size);
+}
+
+int mib_value_set_unsigned(mib_value_t *value, uint64_t val) {
+    size_t size = ber_calc_encoded_uint64_len(&val);
+    uint8_t *data;
+
+    if (!is_unsigned_type(value->type) || (OBJECT_TYPE_COUNTER64 != value->type && val > UINT32_MAX)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (NULL == (data = arena_alloc(value->arena, size))) return -1;
+    ber_encode_uint64(&val, data);
+
+    return set_value(value, data, size);
+}
+
+int mib_value_set_bytes(mib_value_t *value, const void *data, size_t size) {
+    void *copy;
+
+    if ((OBJECT_TYPE_OCTET_STRING != value->type && OBJECT_TYPE_OPAQUE != value->type &&
+         OBJECT_TYPE_IPADDRESS != value->type) || (OBJECT_TYPE_IPADDRESS == value->type && 4 != size)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (NULL == (copy = arena_memdup(value->arena, data, size))) return -1;
+
+    return set_value(value, copy, size);
+}
+
+int mib_value_set_oid(mib_value_t *value, const oid_t *oid) {
+    void *copy;
+
+    if (OBJECT_TYPE_OID != value->type || 0 == oid->len) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (NULL == (copy = arena_memdup(value->arena, oid->data, oid->len))) return -1;
+
+    return set_value(value, copy, oid->len);
+}
+
+// adapter of getters returning allocated or static values
+static int get_untyped_value(const mib_entry_t *entry, mib_value_t *value) {
+    void *val = NULL;
+    size_t size;
+    bool is_allocated = false;
+    int rv;
+
+    if (0 != (NULL != entry->subtree
+              ? entry->subtree->get(entry->data, entry->instance, &val, &size, &is_allocated)
+              : entry->get(entry->data, &val, &size, &is_allocated))) {
+        return -1;
+    }
+
+    switch (entry->type) {
+        case OBJECT_TYPE_INTEGER:
+            rv = mib_value_set_integer(value, *(const int *) val);
+            break;
+        case OBJECT_TYPE_OCTET_STRING:
+            rv = mib_value_set_bytes(value, val, strlen((const char *) val));
+            break;
+        case OBJECT_TYPE_OID:
+            rv = mib_value_set_oid(value, (const oid_t *) val);
+            break;
+        default:
+            errno = EINVAL;
+            rv = -1;
+            break;
+    }
+
+    if (is_allocated) free(val);
+
+    return rv;
+}
+
+// latency of entry of MIB, NULL for instances of subtrees and when index isn't built
+static atomic_uint *get_latency(const mib_entry_t *entry) {
+    uintptr_t pos = (uintptr_t) entry - (uintptr_t) mib.entries;
+
+    if (NULL == mib.latency_us || pos >= mib.entries_cnt * sizeof(*entry)) return NULL;
+
+    return &mib.latency_us[pos / sizeof(*entry)];
+}
+
+// moving average, single slow call marks entry slow at once, while occasional stall of fast getter doesn't
+static void note_latency(atomic_uint *latency, const struct timespec *start) {
+    struct timespec now;
+    unsigned int avg = atomic_load_explicit(latency, memory_order_relaxed);
+    long long us;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    us = (now.tv_sec - start->tv_sec) * 1000000LL + (now.tv_nsec - start->tv_nsec) / 1000;
+    if (us > UINT_MAX / 4) us = UINT_MAX / 4;
+
+    // single slow call makes entry slow at once, fast calls bring it back gradually
+    avg = avg - avg / 4 + (unsigned int) us / 4;
+    if (us > SNMP_MIB_SLOW_GETTER_US && (unsigned int) us > avg) avg = (unsigned int) us;
+
+    // concurrent updates may be lost, average is only an estimate
+    atomic_store_explicit(latency, avg, memory_order_relaxed);
+}
+
+bool mib_is_slow(const mib_entry_t *entry) {
+    atomic_uint *latency;
+
+    if (MIB_SPEED_AUTO != entry->speed) return MIB_SPEED_SLOW == entry->speed;
+
+    return NULL != (latency = get_latency(entry)) &&
+           atomic_load_explicit(latency, memory_order_relaxed) > SNMP_MIB_SLOW_GETTER_US;
+}
+
+int mib_get_encoded(arena_t *arena, const mib_entry_t *mib_entry, void **val, size_t *val_size) {
+    mib_value_t value = { .arena = arena, .type = mib_entry->type };
+    atomic_uint *latency = MIB_SPEED_AUTO == mib_entry->speed ? get_latency(mib_entry) : NULL;
+    struct timespec start;
+    int rv;
+
+    if (NULL != latency) clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (NULL != mib_entry->subtree) {
+        rv = NULL != mib_entry->subtree->get_value
+             ? mib_entry->subtree->get_value(mib_entry->data, mib_entry->instance, &value)
+             : get_untyped_value(mib_entry, &value);
+    } else {
+        rv = NULL != mib_entry->get_value ? mib_entry->get_value(mib_entry->data, &value)
+                                          : get_untyped_value(mib_entry, &value);
+    }
+
+    if (NULL != latency) note_latency(latency, &start);
+
+    if (0 != rv || !value.is_set) return ERROR_STATUS_GEN_ERR;
+
+    *val = value.data;
+    *val_size = value.size;
+
+    return ERROR_STATUS_NO_ERROR;
+}
+
+mib_async_t *mib_async_create(const mib_entry_t *entry, mib_async_handler_t on_complete, void *arg) {
+    mib_async_t *async;
+
+    if (NULL == (async = calloc(1, sizeof(*async)))) return NULL;
+
+    // values are small, default block would waste memory of every request in flight
+    async->arena.block_size = 256;
+    async->value.arena = &async->arena;
+    async->value.type = entry->type;
+    async->status = -1;
+    async->on_complete = on_complete;
+    async->arg = arg;
+
+    return async;
+}
+
+mib_async_t *mib_get_async(const mib_entry_t *entry, mib_async_handler_t on_complete, void *arg) {
+    mib_async_t *async;
+
+    if (NULL == entry->get_async || NULL != entry->subtree ||
+        NULL == (async = mib_async_create(entry, on_complete, arg))) {
+        return NULL;
+    }
+
+    if (0 != entry->get_async(entry->data, async)) {
+        mib_async_free(async);
+        return NULL;
+    }
+
+    return async;
+}
+
+mib_value_t *mib_async_value(mib_async_t *async) {
+    return &async->value;
+}
+
+void mib_async_complete(mib_async_t *async, int status) {
+    async->status = 0 == status && async->value.is_set ? 0 : -1;
+    async->on_complete(async, async->arg);
+}
+
+void mib_async_free(mib_async_t *async) {
+    arena_free(&async->arena);
+    free(async);
+}
+
+int mib_foreach(int (*callback)(mib_entry_t *entry, void *arg), void *arg) {
     size_t i;
-    for (i = 0; i < mib.childs_cnt; i++) {
-        free_mib_node(mib.childs[i]);
+    int rv;
+
+    // callback can change entries
+    if (reserve(mib.entries_cnt) < 0) return -1;
+
+    for (i = 0; i < mib.entries_cnt; i++) {
+        if (0 != (rv = callback(&mib.entries[i], arg))) return rv;
     }
 
-    free(mib.childs);
-}
\ No newline at end of file
+    return 0;
+}
+
+void mib_free() {
+    if (!mib.is_readonly) free(mib.entries);
+    arena_free(&mib.oids);
+    free(mib.slots);
+    free(mib.latency_us);
+
+    mib.slots = NULL;
+    mib.latency_us = NULL;
+    mib.slots_mask = mib.subtrees_cnt = 0;
+    mib.entries = NULL;
+    mib.entries_cnt = mib.entries_cap = 0;
+    mib.is_sorted = true;
+    mib.is_built = mib.is_readonly = false;
+}
@@ -20,23 +20,184 @@
 #define SNMP_SNMP_MIB_H
 
 #include <stdlib.h>
+#include <sys/types.h>
 #include "ber.h"
 
-typedef int (*mib_getter_t)(void **value, size_t *size, bool *is_allocated);
-typedef int (*mib_setter_t)(const void *res, size_t size);
+/*
+ * Getters and setters receive user data given to mib_add_entry(). Getter returns 0 on success, setter returns SNMP
+ * error-status.
+ *
+ * Value of mib_getter_t is int for INTEGER, NUL-terminated string for STRING and oid_t for OID, it's encoded into
+ * response afterwards. Getters of new handlers should be of mib_value_getter_t type.
+ */
+typedef int (*mib_getter_t)(void *data, void **value, size_t *size, bool *is_allocated);
+typedef int (*mib_setter_t)(void *data, const void *res, size_t size);
+
+/*
+ * Value of typed getter, it's encoded right into memory of response by one of mib_value_set_*() functions, so value
+ * is neither allocated nor copied by getter. Getter can use arena for temporary data too.
+ */
+typedef struct mib_value {
+    arena_t *arena;                             // memory of response
+    object_type_t type;                         // type of entry, value must match it
+    void *data;                                 // encoded content
+    size_t size;
+    bool is_set;
+} mib_value_t;
+
+typedef int (*mib_value_getter_t)(void *data, mib_value_t *value);
+
+typedef struct mib_async mib_async_t;
+typedef void (*mib_async_handler_t)(mib_async_t *async, void *arg);
+
+/*
+ * Value obtained by asynchronous getter. Getter starts obtaining value and returns 0 at once, value is set later by
+ * mib_value_set_*() on value of async and reported by mib_async_complete(), which can be called by any thread and
+ * even before getter returns. Getter which returns non-zero value must not complete async.
+ */
+struct mib_async {
+    mib_value_t value;
+    arena_t arena;                              // memory of value, it's kept until async is freed
+    int status;                                 // 0 if value is obtained
+    mib_async_handler_t on_complete;            // called by thread which completes async
+    void *arg;
+    mib_async_t *next;                          // used by owner of async to queue it
+};
+
+typedef int (*mib_async_getter_t)(void *data, mib_async_t *async);
+
+/*
+ * Integers are accepted by INTEGER entries in range of Integer32, unsigned values are accepted by Counter32, Gauge32
+ * and TimeTicks entries in range of 32 bits and by Counter64 entries. Bytes are content of STRING, Opaque or
+ * IpAddress, which must be 4 bytes long. Return -1 and set errno to EINVAL if value doesn't match type of entry.
+ */
+int mib_value_set_integer(mib_value_t *value, int64_t val);
+int mib_value_set_unsigned(mib_value_t *value, uint64_t val);
+int mib_value_set_bytes(mib_value_t *value, const void *data, size_t size);
+int mib_value_set_oid(mib_value_t *value, const oid_t *oid);
+
+#ifndef SNMP_MIB_INSTANCE_LEN_MAX
+#define SNMP_MIB_INSTANCE_LEN_MAX 32
+#endif
+
+// arcs of OID following subtree OID, e.g. row index of table column
+typedef struct mib_instance {
+    size_t len;
+    uint32_t arcs[SNMP_MIB_INSTANCE_LEN_MAX];
+} mib_instance_t;
+
+/*
+ * Serves all instances of subtree, so table column costs single MIB entry regardless of number of rows.
+ * exists() tells if instance is present. next() finds the first instance greater than given one, empty instance
+ * is less than any other, and returns false if there are no more instances. Getters return 0 on success, setter
+ * returns SNMP error-status like the ones of plain entries, setter may be NULL. Typed getter is used if it's given.
+ */
+typedef struct mib_subtree {
+    bool (*exists)(void *data, const mib_instance_t *instance);
+    bool (*next)(void *data, const mib_instance_t *instance, mib_instance_t *next);
+    int (*get)(void *data, const mib_instance_t *instance, void **value, size_t *size, bool *is_allocated);
+    int (*set)(void *data, const mib_instance_t *instance, const void *res, size_t size);
+    int (*get_value)(void *data, const mib_instance_t *instance, mib_value_t *value);
+} mib_subtree_t;
+
+typedef struct cache_slot cache_slot_t;
+typedef struct deadline_rule deadline_rule_t;
+
+/*
+ * Getter of slow entry runs apart from fast ones, see pool_get_async(), speed of automatic entry is measured. Slow
+ * getters of one request run concurrently if they are thread-safe.
+ */
+typedef enum mib_speed {
+    MIB_SPEED_AUTO = 0,
+    MIB_SPEED_FAST,
+    MIB_SPEED_SLOW,
+} mib_speed_t;
+
+// automatic entry becomes slow once call of its getter takes longer, and stays slow while average latency is above it
+#ifndef SNMP_MIB_SLOW_GETTER_US
+#define SNMP_MIB_SLOW_GETTER_US 1000
+#endif
 
 typedef struct mib_entry {
     oid_t oid;
     object_type_t type;
     mib_getter_t get;
     mib_setter_t set;
+    mib_value_getter_t get_value;               // typed getter, used instead of get if it's given
+    mib_async_getter_t get_async;               // optional, used where request can wait, entry keeps getter above
+    void *data;                                 // user data of getter and setter
+    cache_slot_t *cache;                        // cached value, NULL if entry is not cached
+    deadline_rule_t *deadline;                  // deadline of subtree, NULL if only deadline of request applies
+    const mib_subtree_t *subtree;               // handler of subtree, NULL for plain entries
+    const mib_instance_t *instance;             // instance of subtree found by lookup, NULL for subtree itself
+    const char *origin;                         // where handler comes from, e.g. script path, NULL for built-in
+    mib_speed_t speed;
+    bool is_thread_safe;                        // getter can run in several threads at once
 } mib_entry_t;
 
 
-int mib_add_entry(const oid_t *oid, object_type_t type, mib_getter_t getter, mib_setter_t setter);
+int mib_add_entry(const oid_t *oid, object_type_t type, mib_getter_t getter, mib_setter_t setter, void *data);
+int mib_add_value_entry(const oid_t *oid, object_type_t type, mib_value_getter_t getter, mib_setter_t setter,
+                        void *data);
 
-const mib_entry_t *mib_find(const oid_t *oid);
-const mib_entry_t *mib_findnext(const oid_t *oid);
+/*
+ * Registers handler for all OIDs under given one, the subtree OID itself has no value. Entries registered inside of
+ * subtree are dropped as duplicates. Returns the same values as mib_add_entry().
+ */
+int mib_add_subtree(const oid_t *oid, object_type_t type, const mib_subtree_t *subtree, void *data);
+
+/*
+ * Registers entries or subtrees, which OIDs are copied, so they can be created in temporary memory. Entries are only
+ * appended, so index must be built again after that. Conflicts are reported by mib_build_index().
+ */
+int mib_add_entries(const mib_entry_t *entries, size_t cnt);
+
+/*
+ * Serves table generated by mibgen, it must be sorted and free of conflicts. If MIB is empty, table is used in place,
+ * so lookups run over read-only memory, it's copied only when MIB is changed later.
+ */
+int mib_add_table(const mib_entry_t *entries, size_t cnt);
+
+/*
+ * Sorts entries registered so far, must be called after registration and before any lookup. OIDs handled twice and
+ * entries hidden by subtrees are reported to stderr with their origins and dropped, the first registered entry is
+ * kept. Returns -1 with errno set to EEXIST if there were such conflicts.
+ */
+int mib_build_index();
+
+/*
+ * Entries of subtree instances are created in arena, so they are valid until it is reset. Lookup returns NULL also
+ * if such entry can't be allocated.
+ */
+const mib_entry_t *mib_find(arena_t *arena, const oid_t *oid);
+const mib_entry_t *mib_findnext(arena_t *arena, const oid_t *oid);
+
+/*
+ * Calls getter of entry and encodes its value into arena. Returns SNMP error-status, genErr if getter failed, didn't
+ * set value of proper type or value can't be encoded. Latency of getters of automatic entries is measured.
+ */
+int mib_get_encoded(arena_t *arena, const mib_entry_t *entry, void **val, size_t *val_size);
+
+// instances of automatic subtrees aren't measured, they are always fast
+bool mib_is_slow(const mib_entry_t *entry);
+
+/*
+ * Starts asynchronous getter of entry, on_complete receives async which must be freed by mib_async_free(). Returns
+ * NULL if entry has no asynchronous getter or it failed to start, value can be obtained synchronously then.
+ */
+mib_async_t *mib_get_async(const mib_entry_t *entry, mib_async_handler_t on_complete, void *arg);
+
+// creates async which value is obtained by caller, e.g. by running synchronous getter in another thread
+mib_async_t *mib_async_create(const mib_entry_t *entry, mib_async_handler_t on_complete, void *arg);
+mib_value_t *mib_async_value(mib_async_t *async);
+void mib_async_complete(mib_async_t *async, int status);
+void mib_async_free(mib_async_t *async);
+
+/*
+ * Iterates entries in lexicographic order until callback returns non-zero value, which is returned. Subtrees are
+ * iterated as single entries, their instances are not.
+ */
+int mib_foreach(int (*callback)(mib_entry_t *entry, void *arg), void *arg);
 
 void mib_free();
 
@@ -0,0 +1,250 @@
+/*
+ * mibgen.c
+ * Copyright (c) 2020 Sergei Kosivchenko <archichief@gmail.com>
+ *
+ * smart-snmp is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * smart-snmp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Turns MIB definition file into C table served by mib_add_table(), so MIB fixed at build time costs nothing at
+ * startup and lives in read-only memory. Every line of definition file looks like
+ *
+ *      <OID> <TYPE> <getter> [fast|slow]
+ *      <OID> <TYPE> subtree <handler> [fast|slow]
+ *
+ * where TYPE is one of accepted by string_to_type(), getter is a function of mib_value_getter_t type and handler is
+ * a mib_subtree_t object, both must be defined with external linkage. Speed of handler is learned at runtime unless
+ * it's declared, see mib_is_slow(). Empty lines and text after '#' are ignored.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "utilities.h"
+
+typedef struct definition {
+    oid_t oid;
+    char *oid_str;
+    object_type_t type;
+    char *handler;
+    const char *speed;                          // enumerator of mib_speed_t
+    bool is_subtree;
+    size_t line;
+} definition_t;
+
+static definition_t *definitions;
+static size_t definitions_cnt;
+
+static bool is_identifier(const char *str) {
+    if (!isalpha((unsigned char) *str) && '_' != *str) return false;
+
+    while (*++str) {
+        if (!isalnum((unsigned char) *str) && '_' != *str) return false;
+    }
+
+    return true;
+}
+
+// order of lines is kept among equal OIDs, so the first one is reported as kept
+static int compare_definitions(const void *a, const void *b) {
+    const definition_t *da = a, *db = b;
+    int res = oid_compare(&da->oid, &db->oid);
+
+    return res ? res : (da->line > db->line) - (da->line < db->line);
+}
+
+static const char *parse_speed(const char *str) {
+    if (0 == strcmp(str, "fast")) return "MIB_SPEED_FAST";
+    if (0 == strcmp(str, "slow")) return "MIB_SPEED_SLOW";
+
+    return NULL;
+}
+
+static int parse(FILE *in, const char *path, arena_t *arena) {
+    char line[1024], *tokens[5], *hash;
+    size_t line_num = 0, tokens_cnt, handler_pos, cap = 0;
+    definition_t *def;
+
+    while (NULL != fgets(line, sizeof(line), in)) {
+        line_num++;
+
+        if (NULL != (hash = strchr(line, '#'))) *hash = '\0';
+
+        for (tokens_cnt = 0; tokens_cnt < 5; tokens_cnt++) {
+            if (NULL == (tokens[tokens_cnt] = strtok(tokens_cnt ? NULL : line, " \t\r\n"))) break;
+        }
+
+        if (0 == tokens_cnt) continue;
+
+        if (definitions_cnt == cap) {
+            cap = cap ? cap * 2 : 64;
+            if (NULL == (def = realloc(definitions, cap * sizeof(*definitions)))) return -1;
+            definitions = def;
+        }
+
+        def = &definitions[definitions_cnt];
+        def->line = line_num;
+        def->is_subtree = tokens_cnt >= 4 && 0 == strcmp(tokens[2], "subtree");
+        handler_pos = def->is_subtree ? 3 : 2;
+        def->handler = tokens[handler_pos];
+        def->speed = tokens_cnt > handler_pos + 1 ? parse_speed(tokens[handler_pos + 1]) : "MIB_SPEED_AUTO";
+
+        if (tokens_cnt < 3 || tokens_cnt > handler_pos + 2 || NULL == def->speed ||
+            NULL != strtok(NULL, " \t\r\n") || 0 != string_to_oid(arena, tokens[0], &def->oid) ||
+            0 != string_to_type(tokens[1], &def->type) || !is_identifier(def->handler)) {
+            fprintf(stderr, "%s:%zu: expected '<OID> <TYPE> <getter> [fast|slow]' or "
+                            "'<OID> <TYPE> subtree <handler> [fast|slow]'\n", path, line_num);
+            errno = EINVAL;
+            return -1;
+        }
+
+        if (NULL == (def->oid_str = arena_memdup(arena, tokens[0], strlen(tokens[0]) + 1)) ||
+            NULL == (def->handler = arena_memdup(arena, def->handler, strlen(def->handler) + 1))) {
+            return -1;
+        }
+
+        definitions_cnt++;
+    }
+
+    return ferror(in) ? -1 : 0;
+}
+
+// the same checks as mib_build_index() does at runtime, but all conflicts are fatal
+static int check(const char *path) {
+    size_t i, kept = 0;
+    int rv = 0;
+
+    for (i = 1; i < definitions_cnt; i++) {
+        if (0 == oid_compare(&definitions[kept].oid, &definitions[i].oid) ||
+            (definitions[kept].is_subtree && oid_is_in_subtree(&definitions[i].oid, &definitions[kept].oid))) {
+            fprintf(stderr, "%s:%zu: OID %s handled by %s is %s %s at line %zu\n", path, definitions[i].line,
+                    definitions[i].oid_str, definitions[i].handler,
+                    definitions[i].oid.len == definitions[kept].oid.len ? "already handled by"
+                                                                        : "inside of subtree handled by",
+                    definitions[kept].handler, definitions[kept].line);
+            rv = -1;
+        } else {
+            kept = i;
+        }
+    }
+
+    return rv;
+}
+
+static bool is_declared(size_t cnt, const char *handler) {
+    size_t i;
+
+    for (i = 0; i < cnt; i++) {
+        if (0 == strcmp(definitions[i].handler, handler)) return true;
+    }
+
+    return false;
+}
+
+static void generate(FILE *out, const char *path) {
+    const definition_t *def;
+    size_t i, j;
+
+    fprintf(out, "/* Generated by mibgen from %s, do not edit */\n\n#include \"mib_table.h\"\n\n", path);
+
+    for (i = 0; i < definitions_cnt; i++) {
+        def = &definitions[i];
+        if (is_declared(i, def->handler)) continue;
+
+        if (def->is_subtree) {
+            fprintf(out, "extern const mib_subtree_t %s;\n", def->handler);
+        } else {
+            fprintf(out, "int %s(void *data, mib_value_t *value);\n", def->handler);
+        }
+    }
+
+    fprintf(out, "\n");
+
+    for (i = 0; i < definitions_cnt; i++) {
+        def = &definitions[i];
+        fprintf(out, "static const uint8_t oid_%zu[] = {", i);
+
+        for (j = 0; j < def->oid.len; j++) {
+            fprintf(out, "%s0x%02x", j ? ", " : " ", def->oid.data[j]);
+        }
+
+        fprintf(out, " };  /* %s */\n", def->oid_str);
+    }
+
+    // ISO C doesn't allow empty initializers
+    if (0 == definitions_cnt) {
+        fprintf(out, "const mib_entry_t mib_table[1];\nconst size_t mib_table_cnt = 0;\n");
+        return;
+    }
+
+    fprintf(out, "\nconst mib_entry_t mib_table[] = {\n");
+
+    for (i = 0; i < definitions_cnt; i++) {
+        def = &definitions[i];
+        fprintf(out, "        { .oid = { sizeof(oid_%zu), oid_%zu }, .type = 0x%02x, .%s = %s%s, .speed = %s },\n", i,
+                i, def->type, def->is_subtree ? "subtree" : "get_value", def->is_subtree ? "&" : "", def->handler,
+                def->speed);
+    }
+
+    fprintf(out, "};\n\nconst size_t mib_table_cnt = sizeof(mib_table) / sizeof(*mib_table);\n");
+}
+
+int main(int argc, char *argv[]) {
+    arena_t arena = { 0 };
+    FILE *in = NULL, *out = NULL;
+    int rv = EXIT_FAILURE;
+
+    if (3 != argc) {
+        fprintf(stderr, "Usage: %s <definition file> <output C file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (NULL == (in = fopen(argv[1], "r"))) {
+        fprintf(stderr, "Can't open %s: %s\n", argv[1], strerror(errno));
+        goto end;
+    }
+
+    if (0 != parse(in, argv[1], &arena)) {
+        if (EINVAL != errno) fprintf(stderr, "Can't read %s: %s\n", argv[1], strerror(errno));
+        goto end;
+    }
+
+    qsort(definitions, definitions_cnt, sizeof(*definitions), compare_definitions);
+
+    if (0 != check(argv[1])) goto end;
+
+    if (NULL == (out = fopen(argv[2], "w"))) {
+        fprintf(stderr, "Can't create %s: %s\n", argv[2], strerror(errno));
+        goto end;
+    }
+
+    generate(out, argv[1]);
+
+    if (0 != fclose(out)) {
+        fprintf(stderr, "Can't write %s: %s\n", argv[2], strerror(errno));
+        remove(argv[2]);
+        goto end;
+    }
+
+    rv = EXIT_SUCCESS;
+
+    end:
+    if (NULL != in) fclose(in);
+    free(definitions);
+    arena_free(&arena);
+
+    return rv;
+}
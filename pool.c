@@ -0,0 +1,347 @@
+/*
+ * pool.c
+ * Copyright (c) 2020 Sergei Kosivchenko <archichief@gmail.com>
+ *
+ * smart-snmp is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * smart-snmp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+
+#include "pool.h"
+#include "singleflight.h"
+
+typedef struct pool_job {
+    const mib_entry_t *entry;
+    mib_async_t *async;
+} pool_job_t;
+
+// sequence of cell tells whether it is free for producer or filled for consumer
+typedef struct pool_cell {
+    atomic_size_t seq;
+    pool_job_t job;
+} pool_cell_t;
+
+// bounded lock-free queue, producers claim cells by moving tail, consumers take them by moving head
+typedef struct pool_queue {
+    pool_cell_t cells[SNMP_POOL_QUEUE_SIZE];
+    atomic_size_t tail;
+    atomic_size_t head;
+} pool_queue_t;
+
+/*
+ * Every thread has its own queue filled by workers in turn. Thread whose queue is empty steals getters from queues of
+ * others before it sleeps on eventfd, so getter never waits behind a long one while some thread is idle.
+ */
+typedef struct pool_thread {
+    pthread_t thread;
+    pool_queue_t queue;
+    atomic_bool is_sleeping;
+    int eventfd;
+    bool is_started;
+} pool_thread_t;
+
+typedef struct pool {
+    pool_thread_t *threads;
+    size_t threads_cnt;
+    pool_queue_t serial;                        // getters which aren't thread-safe, run by the first thread only
+    atomic_size_t next;                         // thread tried first by next getter
+    atomic_bool is_stopped;
+    int (*thread_init)();
+    void (*thread_free)();
+
+    atomic_ulong runs;
+    atomic_ulong steals;                        // getters run by thread other than the one they were queued to
+    atomic_ulong rejects;                       // getters failed because of full queues
+} pool_t;
+
+static pool_t pool;
+
+static void init_queue(pool_queue_t *queue) {
+    size_t i;
+
+    for (i = 0; i < SNMP_POOL_QUEUE_SIZE; i++) atomic_init(&queue->cells[i].seq, i);
+}
+
+static bool enqueue(pool_queue_t *queue, const pool_job_t *job) {
+    size_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed), seq;
+    pool_cell_t *cell;
+    intptr_t diff;
+
+    for (;;) {
+        cell = &queue->cells[pos & (SNMP_POOL_QUEUE_SIZE - 1)];
+        seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        diff = (intptr_t) seq - (intptr_t) pos;
+
+        if (0 == diff) {
+            if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // cell of previous round isn't taken yet, queue is full
+            return false;
+        } else {
+            pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        }
+    }
+
+    cell->job = *job;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+
+    return true;
+}
+
+static bool dequeue(pool_queue_t *queue, pool_job_t *job) {
+    size_t pos = atomic_load_explicit(&queue->head, memory_order_relaxed), seq;
+    pool_cell_t *cell;
+    intptr_t diff;
+
+    for (;;) {
+        cell = &queue->cells[pos & (SNMP_POOL_QUEUE_SIZE - 1)];
+        seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        diff = (intptr_t) seq - (intptr_t) (pos + 1);
+
+        if (0 == diff) {
+            if (atomic_compare_exchange_weak_explicit(&queue->head, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+        }
+    }
+
+    *job = cell->job;
+    atomic_store_explicit(&cell->seq, pos + SNMP_POOL_QUEUE_SIZE, memory_order_release);
+
+    return true;
+}
+
+static bool wake(pool_thread_t *t) {
+    uint64_t one = 1;
+
+    if (!atomic_load_explicit(&t->is_sleeping, memory_order_relaxed) || !atomic_exchange(&t->is_sleeping, false)) {
+        return false;
+    }
+
+    if (write(t->eventfd, &one, sizeof(one))) {}
+
+    return true;
+}
+
+/*
+ * Threads announce sleep before they check queues the last time, so after getter is queued either some thread sees
+ * it or sleeping one is woken up. If owner of queue is busy, getter which can be stolen is left for idle thread.
+ */
+static void wake_for(pool_thread_t *owner, bool can_steal) {
+    size_t i;
+
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (wake(owner) || !can_steal) return;
+
+    for (i = 0; i < pool.threads_cnt && !wake(&pool.threads[i]); i++);
+}
+
+/*
+ * Serial getters are run only by the first thread, so it takes them before its own queue, which can be emptied by
+ * others. Other threads take getters from their own queue and steal from other queues then.
+ */
+static bool take_job(pool_thread_t *t, pool_job_t *job) {
+    size_t self = (size_t) (t - pool.threads), i;
+
+    if ((0 == self && dequeue(&pool.serial, job)) || dequeue(&t->queue, job)) return true;
+
+    for (i = 1; i < pool.threads_cnt; i++) {
+        if (dequeue(&pool.threads[(self + i) % pool.threads_cnt].queue, job)) {
+            atomic_fetch_add_explicit(&pool.steals, 1, memory_order_relaxed);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// value is encoded right into memory of async, concurrent calls of the same getter are shared
+static void run_job(const pool_job_t *job, bool is_ready) {
+    mib_value_t *value = mib_async_value(job->async);
+    size_t val_size;
+    void *val;
+    int status = -1;
+
+    // getters queued at exit aren't run, they fail
+    if (is_ready && !atomic_load(&pool.is_stopped)) {
+        atomic_fetch_add_explicit(&pool.runs, 1, memory_order_relaxed);
+
+        if (ERROR_STATUS_NO_ERROR == singleflight_get_encoded(value->arena, job->entry, &val, &val_size)) {
+            value->data = val;
+            value->size = val_size;
+            value->is_set = true;
+            status = 0;
+        }
+    }
+
+    mib_async_complete(job->async, status);
+}
+
+static void *pool_routine(void *arg) {
+    pool_thread_t *t = arg;
+    pool_job_t job;
+    uint64_t cnt;
+    bool is_ready = NULL == pool.thread_init || 0 == pool.thread_init();
+
+    for (;;) {
+        if (take_job(t, &job)) {
+            run_job(&job, is_ready);
+            continue;
+        }
+
+        if (atomic_load(&pool.is_stopped)) break;
+
+        atomic_store(&t->is_sleeping, true);
+        atomic_thread_fence(memory_order_seq_cst);
+
+        if (take_job(t, &job)) {
+            atomic_store(&t->is_sleeping, false);
+            run_job(&job, is_ready);
+            continue;
+        }
+
+        if (read(t->eventfd, &cnt, sizeof(cnt))) {}
+    }
+
+    if (is_ready && NULL != pool.thread_free) pool.thread_free();
+
+    return NULL;
+}
+
+int pool_start(size_t threads, int (*thread_init)(), void (*thread_free)()) {
+    pool_thread_t *t;
+    size_t i;
+    int rv;
+
+    if (0 == threads) return 0;
+
+    if (NULL == (pool.threads = calloc(threads, sizeof(*pool.threads)))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    pool.thread_init = thread_init;
+    pool.thread_free = thread_free;
+    atomic_store(&pool.is_stopped, false);
+    init_queue(&pool.serial);
+
+    for (i = 0; i < threads; i++) {
+        t = &pool.threads[pool.threads_cnt];
+
+        init_queue(&t->queue);
+
+        // thread blocks on eventfd while its queue is empty
+        if (-1 == (t->eventfd = eventfd(0, EFD_CLOEXEC))) goto fail;
+
+        pool.threads_cnt++;
+
+        if (0 != (rv = pthread_create(&t->thread, NULL, pool_routine, t))) {
+            errno = rv;
+            goto fail;
+        }
+
+        t->is_started = true;
+    }
+
+    return 0;
+
+    fail:
+    rv = errno;
+    pool_free();
+    errno = rv;
+
+    return -1;
+}
+
+mib_async_t *pool_get_async(const mib_entry_t *entry, mib_async_handler_t on_complete, void *arg) {
+    pool_job_t job = { .entry = entry };
+    pool_thread_t *t;
+    size_t first, i;
+
+    if (0 == pool.threads_cnt || NULL == (job.async = mib_async_create(entry, on_complete, arg))) return NULL;
+
+    if (!entry->is_thread_safe) {
+        if (enqueue(&pool.serial, &job)) {
+            wake_for(&pool.threads[0], false);
+            return job.async;
+        }
+    } else {
+        // varbinds of one request are spread over threads, queue of busy thread is emptied by idle ones
+        first = atomic_fetch_add_explicit(&pool.next, 1, memory_order_relaxed);
+
+        for (i = 0; i < pool.threads_cnt; i++) {
+            t = &pool.threads[(first + i) % pool.threads_cnt];
+
+            if (enqueue(&t->queue, &job)) {
+                wake_for(t, true);
+                return job.async;
+            }
+        }
+    }
+
+    // request fails fast instead of piling up behind stuck getters
+    atomic_fetch_add_explicit(&pool.rejects, 1, memory_order_relaxed);
+    mib_async_complete(job.async, -1);
+
+    return job.async;
+}
+
+bool pool_is_running() {
+    return pool.threads_cnt > 0;
+}
+
+void pool_print_stats() {
+    if (0 == pool.threads_cnt) return;
+
+    fprintf(stderr, "Slow handlers: runs: %lu, steals: %lu, rejected: %lu\n", atomic_load(&pool.runs),
+            atomic_load(&pool.steals), atomic_load(&pool.rejects));
+}
+
+void pool_free() {
+    pool_thread_t *t;
+    uint64_t one = 1;
+    size_t i;
+
+    atomic_store(&pool.is_stopped, true);
+
+    for (i = 0; i < pool.threads_cnt; i++) {
+        t = &pool.threads[i];
+
+        if (t->is_started) {
+            if (write(t->eventfd, &one, sizeof(one))) {}
+            pthread_join(t->thread, NULL);
+        }
+
+        close(t->eventfd);
+    }
+
+    free(pool.threads);
+    pool.threads = NULL;
+    pool.threads_cnt = 0;
+}
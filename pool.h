@@ -0,0 +1,58 @@
+/*
+ * pool.h
+ * Copyright (c) 2020 Sergei Kosivchenko <archichief@gmail.com>
+ *
+ * smart-snmp is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * smart-snmp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SNMP_POOL_H
+#define SNMP_POOL_H
+
+#include "mib.h"
+
+#ifndef SNMP_POOL_THREADS
+#define SNMP_POOL_THREADS 2
+#endif
+
+// getters queued for every thread of pool, must be power of 2
+#ifndef SNMP_POOL_QUEUE_SIZE
+#define SNMP_POOL_QUEUE_SIZE 64
+#endif
+
+/*
+ * Starts threads running getters of slow entries, see mib_is_slow(), so requests for fast values never wait behind
+ * them. thread_init and thread_free, if given, are called by every thread of pool, so getters needing per-thread
+ * state work. Pool without threads isn't started.
+ */
+int pool_start(size_t threads, int (*thread_init)(), void (*thread_free)());
+
+/*
+ * Runs getter of entry by thread of pool, on_complete receives async like the one of mib_get_async(). Thread-safe
+ * getters are spread over all threads, idle thread takes them from queues of busy ones, so getters of one request
+ * run at once. Other getters are run one by one by the first thread. If queue is full, async fails at once instead
+ * of waiting for free place. Returns NULL if pool isn't started or async can't be created, getter is called in place
+ * then.
+ */
+mib_async_t *pool_get_async(const mib_entry_t *entry, mib_async_handler_t on_complete, void *arg);
+
+// false if pool has no threads, slow getters are called in place then
+bool pool_is_running();
+
+// prints counters of getters run, taken from queues of other threads and rejected because of full queues
+void pool_print_stats();
+
+// stops threads, queued getters fail without being run, must be called after workers are stopped
+void pool_free();
+
+#endif //SNMP_POOL_H
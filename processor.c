@@ -18,23 +18,85 @@
 
 #include <memory.h>
 #include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 
 #include "processor.h"
 #include "ber.h"
 #include "mib.h"
+#include "cache.h"
+#include "singleflight.h"
+#include "pool.h"
+#include "deadline.h"
 #include "utilities.h"
 #include "asn1/asn1.h"
 
 typedef bool (*check_strategy_t)(const asn1_node_t *req);
 
-typedef const mib_entry_t *(*search_func_t)(const oid_t *oid);
+typedef const mib_entry_t *(*search_func_t)(arena_t *arena, const oid_t *oid);
+
+// returned instead of error-status when value is obtained asynchronously
+#define VALUE_PENDING (-1)
+
+typedef struct parked_request parked_request_t;
+typedef struct pending_varbind pending_varbind_t;
+
+// collects varbinds of response and keeps track of its encoded size and error
+typedef struct resp_builder {
+    arena_t *arena;
+    snmp_version_t version;
+    asn1_node_t *vb_list;
+    size_t vb_list_size;                        // encoded size of varbinds
+    size_t size_limit;                          // varbinds must fit into datagram together with headers
+    error_status_t error_status;
+    int error_index;
+    snmp_processor_t *processor;                // NULL if request can't wait for asynchronous values
+    parked_request_t *parked;                   // set once the first asynchronous getter has started
+    pending_varbind_t *started;                 // the last requested asynchronous value
+} resp_builder_t;
+
+struct snmp_processor {
+    event_loop_t *loop;                         // fires deadlines of parked requests
+    int eventfd;
+    pthread_mutex_t lock;
+    mib_async_t *completed;                     // completed by other threads and not handled yet
+    bool is_closing;                            // responses aren't sent anymore
+    uint8_t buffer[SNMP_MAX_DATAGRAM_SIZE];     // responses of parked requests are encoded here
+};
+
+// request waiting for asynchronous values, all its memory is in its own arena
+struct parked_request {
+    arena_t arena;
+    snmp_processor_t *processor;
+    resp_builder_t builder;
+    snmp_message_t msg;
+    snmp_peer_t peer;
+    size_t pending;                             // getters in flight, memory is kept until all of them complete
+    size_t waiting;                             // values neither arrived nor expired, response is sent at zero
+    bool is_too_big;
+    bool is_failed;                             // request is dropped once all values arrive
+};
+
+// varbind which value is obtained asynchronously
+struct pending_varbind {
+    parked_request_t *parked;
+    const mib_entry_t *entry;
+    asn1_node_t *value;                         // NULL until varbind is added to response
+    size_t name_size;
+    int index;
+    event_timeout_t deadline;
+    bool is_resolved;                           // value arrived or deadline passed
+};
 
 static bool is_version_supported(snmp_version_t ver) {
     return SNMP_VERSION_3 != ver; // version 3 doesn't support
 }
 
-static bool is_community_supported(const char *comunity) {
-    return 0 == strcmp(comunity, "public");
+static bool is_community_supported(const char *comunity, size_t size) {
+    static const char supported[] = "public";
+
+    return sizeof(supported) - 1 == size && 0 == memcmp(comunity, supported, size);
 }
 
 // check GetRequest, GetNextRequest, GetResponse, SetRequest
@@ -98,7 +160,6 @@ static check_strategy_t is_request_type_supported(request_type_t type) {
 static const asn1_node_t *check_snmp_request(const asn1_node_t *req) {
     const asn1_node_t *item, *pdu = NULL;
     snmp_version_t version;
-    char *community = NULL;
     check_strategy_t strategy;
 
     // root must be SEQUENCE with 3 elements
@@ -118,8 +179,7 @@ static const asn1_node_t *check_snmp_request(const asn1_node_t *req) {
     // second element is SNMP Community String
     item = req->content.c.items[1];
     if (OBJECT_TYPE_OCTET_STRING != item->type ||
-        ber_decode_octet_string(item->content.p.data, item->content.p.size, &community) < 1 ||
-        !is_community_supported(community)) {
+        !is_community_supported(item->content.p.data, item->content.p.size)) {
         goto end;
     }
 
@@ -132,124 +192,632 @@ static const asn1_node_t *check_snmp_request(const asn1_node_t *req) {
     pdu = item;
 
     end:
-    free(community);
     return pdu;
 }
 
-static bool encode_data(const mib_entry_t *mib_entry, void **val, size_t *val_size) {
-    void *mib_val = NULL;
-    size_t mib_val_size;
-    bool mib_is_allocated;
+// called by thread which obtained value, it's handled by thread of processor
+static void handle_async_completion(mib_async_t *async, void *arg) {
+    snmp_processor_t *processor = ((pending_varbind_t *) arg)->parked->processor;
+    uint64_t one = 1;
 
-    mib_entry->get(&mib_val, &mib_val_size, &mib_is_allocated);
+    pthread_mutex_lock(&processor->lock);
+    async->next = processor->completed;
+    processor->completed = async;
+    pthread_mutex_unlock(&processor->lock);
 
-    switch (mib_entry->type) {
-        case OBJECT_TYPE_INTEGER:
-            *val_size = ber_calc_encoded_integer_len((const int *) mib_val);
-            *val = malloc(*val_size);
-            ber_encode_integer((const int *) mib_val, *val);
-            break;
-        case OBJECT_TYPE_OCTET_STRING:
-            *val_size = ber_calc_encoded_octet_string_len((const char *) mib_val);
-            *val = malloc(*val_size);
-            ber_encode_octet_string((const char *) mib_val, *val);
-            break;
-        case OBJECT_TYPE_OID:
-            *val_size = ber_calc_encoded_oid_len((const oid_t *) mib_val);
-            *val = malloc(*val_size);
-            ber_encode_oid((const oid_t *) mib_val, *val);
-            break;
-        default:
-            if (mib_is_allocated) free(mib_val);
-            return false;
+    // counter overflow means processor is already woken up
+    if (write(processor->eventfd, &one, sizeof(one))) {}
+}
+
+static void handle_deadline(event_loop_t *loop, event_timeout_t *timeout);
+
+static bool start_async(resp_builder_t *builder, const mib_entry_t *mib_entry) {
+    parked_request_t *parked = builder->parked;
+    pending_varbind_t *pending;
+    unsigned long ms;
+
+    if (NULL == parked && NULL == (parked = arena_calloc(builder->arena, sizeof(*parked)))) return false;
+    if (NULL == (pending = arena_calloc(builder->arena, sizeof(*pending)))) return false;
+
+    parked->processor = builder->processor;
+    pending->parked = parked;
+    pending->entry = mib_entry;
+
+    // slow synchronous getters run in pool, so fast values of other requests don't wait behind them
+    if (NULL == (NULL != mib_entry->get_async ? mib_get_async(mib_entry, handle_async_completion, pending)
+                                              : pool_get_async(mib_entry, handle_async_completion, pending))) {
+        return false;
     }
 
-    if (mib_is_allocated) free(mib_val);
+    // request is parked only once some getter has started, otherwise its values are all obtained in place
+    builder->parked = parked;
+    builder->parked->pending++;
+    builder->parked->waiting++;
+    builder->started = pending;
+
+    // request is parked before loop fires anything, so deadline finds it complete
+    if (0 != (ms = deadline_get(mib_entry))) {
+        pending->deadline.handler = handle_deadline;
+        pending->deadline.user_data = pending;
+        event_loop_add_timeout(builder->processor->loop, &pending->deadline, (unsigned int) ms);
+    }
 
     return true;
 }
 
-static bool handle_get_request(const asn1_node_t *pdu, asn1_node_t *resp, search_func_t search) {
-    size_t i;
-    oid_t oid;
-    size_t vbs_cnt = pdu->content.c.items[3]->content.c.items_num;
-    asn1_node_t **req_vbs = pdu->content.c.items[3]->content.c.items,
-            *resp_pdu = NULL, *resp_vb = NULL, *resp_vb_list;
-    const asn1_node_t *req_vb_key, *pdu_root = pdu->root;
-    const mib_entry_t *mib_entry;
+/*
+ * Cached values are served without calling getter. If request can wait, asynchronous or slow getter is started and
+ * VALUE_PENDING is returned, otherwise concurrent misses share one getter call. Fresh values are cached.
+ */
+static int encode_data(resp_builder_t *builder, const mib_entry_t *mib_entry, void **val, size_t *val_size) {
+    arena_t *arena = builder->arena;
+    int res;
+
+    if (NULL != mib_entry->cache && cache_get(mib_entry->cache, arena, val, val_size)) return ERROR_STATUS_NO_ERROR;
+
+    if (NULL != builder->processor &&
+        (NULL != mib_entry->get_async || (pool_is_running() && mib_is_slow(mib_entry))) &&
+        start_async(builder, mib_entry)) {
+        return VALUE_PENDING;
+    }
+
+    res = singleflight_get_encoded(arena, mib_entry, val, val_size);
+
+    if (ERROR_STATUS_NO_ERROR == res && NULL != mib_entry->cache) {
+        cache_put(mib_entry->cache, *val, *val_size);
+    }
+
+    return res;
+}
+
+// check message parsed by streaming parser, same rules as check_snmp_request() and check_non_trap_request() apply
+static bool check_snmp_message(const snmp_message_t *msg) {
+    snmp_version_t version;
+    int val = 0;
+
+    if (msg->version.size != 1 ||
+        ber_decode_integer(msg->version.data, msg->version.size, (int *) &version) != 1 ||
+        !is_version_supported(version)) {
+        return false;
+    }
+
+    if (!is_community_supported((const char *) msg->community.data, msg->community.size)) return false;
+
+    if (ber_decode_integer(msg->request_id.data, msg->request_id.size, &val) < 1 || val < 0) return false;
+
+    // GetBulkRequest exists only since SNMPv2c and carries non-repeaters and max-repetitions instead of errors
+    if (REQUEST_TYPE_GETBULK == msg->pdu_type) {
+        return SNMP_VERSION_2C == version &&
+               ber_decode_integer(msg->error_status.data, msg->error_status.size, &val) > 0 && val >= 0 &&
+               ber_decode_integer(msg->error_index.data, msg->error_index.size, &val) > 0 && val >= 0;
+    }
+
+    if (ber_decode_integer(msg->error_status.data, msg->error_status.size, &val) != 1 || val > 0 ||
+        ber_decode_integer(msg->error_index.data, msg->error_index.size, &val) != 1 || val > 0) {
+        return false;
+    }
+
+    return true;
+}
+
+// encoded size of element with content of given size
+static inline size_t tlv_size(size_t content_size) {
+    return 1 + ber_calc_encoded_length_len(&content_size) + content_size;
+}
+
+// upper bound of everything in response except of varbinds content: headers, version, community and PDU fields
+static inline size_t response_overhead(const snmp_message_t *req) {
+    return 33 + req->community.size + req->request_id.size;
+}
 
+static void init_builder(resp_builder_t *builder, arena_t *arena, const snmp_message_t *req, size_t resp_buffer_size) {
+    size_t overhead = response_overhead(req);
+
+    memset(builder, 0, sizeof(*builder));
+    builder->arena = arena;
+    builder->version = SNMP_VERSION_1;
+    builder->size_limit = resp_buffer_size > overhead ? resp_buffer_size - overhead : 0;
+
+    ber_decode_integer(req->version.data, req->version.size, (int *) &builder->version);
+}
+
+static bool create_integer_node(arena_t *arena, asn1_node_t *root, int val) {
+    size_t size = ber_calc_encoded_integer_len(&val);
+    uint8_t *data;
+
+    if (NULL == (data = arena_alloc(arena, size))) return false;
+    ber_encode_integer(&val, data);
+
+    return NULL != create_asn1_node(arena, root, OBJECT_TYPE_INTEGER, data, size);
+}
+
+// encoded size of varbind
+static inline size_t varbind_size(size_t name_size, size_t val_size) {
+    return tlv_size(tlv_size(name_size) + tlv_size(val_size));
+}
+
+/*
+ * Adds varbind to response and accounts its encoded size, varbind which doesn't fit into response is not added.
+ * Returns node of value.
+ */
+static asn1_node_t *append_varbind(resp_builder_t *builder, const void *name, size_t name_size, int type,
+                                   const void *val, size_t val_size) {
+    asn1_node_t *resp_vb, *resp_val;
+    size_t vb_size = varbind_size(name_size, val_size);
+
+    if (builder->vb_list_size + vb_size > builder->size_limit) {
+        errno = ENOBUFS;
+        return NULL;
+    }
+
+    if (NULL == (resp_vb = create_asn1_node(builder->arena, builder->vb_list, OBJECT_TYPE_SEQUENCE, NULL, 0)) ||
+        NULL == create_asn1_node(builder->arena, resp_vb, OBJECT_TYPE_OID, name, name_size) ||
+        NULL == (resp_val = create_asn1_node(builder->arena, resp_vb, type, val, val_size))) {
+        return NULL;
+    }
+
+    builder->vb_list_size += vb_size;
+
+    return resp_val;
+}
+
+static inline bool add_varbind(resp_builder_t *builder, const void *name, size_t name_size, int type,
+                               const void *val, size_t val_size) {
+    return NULL != append_varbind(builder, name, name_size, type, val, val_size);
+}
+
+// only first error in order of varbinds is reported, index is 1-based
+static void set_error_at(resp_builder_t *builder, error_status_t status, int index) {
+    if (ERROR_STATUS_NO_ERROR != builder->error_status && builder->error_index <= index) return;
+
+    builder->error_status = status;
+    builder->error_index = index;
+}
+
+// error of varbind added last
+static void set_error(resp_builder_t *builder, error_status_t status) {
+    set_error_at(builder, status, (int)builder->vb_list->content.c.items_num);
+}
+
+/*
+ * Looks up OID and adds found value to response. Varbind is named by the found entry for GetNextRequest and by the
+ * requested OID otherwise. Missing values are reported by exceptions in SNMPv2c and noSuchName error in SNMPv1.
+ */
+static bool handle_oid(resp_builder_t *builder, const oid_t *oid, search_func_t search, const mib_entry_t **found) {
+    const mib_entry_t *mib_entry = search(builder->arena, oid);
+    const oid_t *name = NULL != mib_entry ? &mib_entry->oid : oid;
     size_t encoded_val_size;
     void *encoded_val;
+    static const uint8_t null_val[1];
+
+    if (NULL != found) *found = mib_entry;
+
+    if (NULL != mib_entry) {
+        switch (encode_data(builder, mib_entry, &encoded_val, &encoded_val_size)) {
+            case VALUE_PENDING:
+                // varbind is counted as NULL until value arrives, getter already started finds no varbind on failure
+                if (NULL == (builder->started->value = append_varbind(builder, name->data, name->len,
+                                                                      OBJECT_TYPE_NULL, null_val, 0))) {
+                    return false;
+                }
+
+                builder->started->name_size = name->len;
+                builder->started->index = (int)builder->vb_list->content.c.items_num;
+                return true;
+            case ERROR_STATUS_NO_ERROR:
+                return add_varbind(builder, name->data, name->len, mib_entry->type, encoded_val, encoded_val_size);
+            case ERROR_STATUS_GEN_ERR:
+                if (!add_varbind(builder, name->data, name->len, OBJECT_TYPE_NULL, null_val, 0)) return false;
+
+                set_error(builder, ERROR_STATUS_GEN_ERR);
+                return true;
+            default:
+                return false;
+        }
+    }
 
-    resp_vb_list = create_asn1_node(NULL, OBJECT_TYPE_SEQUENCE, NULL, 0, false);
+    if (SNMP_VERSION_1 == builder->version) {
+        if (!add_varbind(builder, name->data, name->len, OBJECT_TYPE_NULL, null_val, 0)) return false;
 
-    for (i = 0; i < vbs_cnt; i++) {
-        req_vb_key = req_vbs[i]->content.c.items[0];
+        set_error(builder, ERROR_STATUS_NO_SUCH_NAME);
+        return true;
+    }
 
-        resp_vb = create_asn1_node(resp_vb_list, OBJECT_TYPE_SEQUENCE, NULL, 0, false);
+    return add_varbind(builder, name->data, name->len,
+                       mib_find == search ? OBJECT_TYPE_NO_OBJECT : OBJECT_TYPE_END_OF_VIEW, null_val, 0);
+}
+
+static bool handle_varbind(resp_builder_t *builder, const ber_tlv_t *name, search_func_t search) {
+    oid_t oid;
 
-        ber_decode_oid(req_vb_key->content.p.data, req_vb_key->content.p.size, &oid);
+    if (ber_decode_oid(name->data, name->size, &oid) < 0) return false;
 
-        encoded_val_size = req_vb_key->content.p.size;
-        encoded_val = malloc(encoded_val_size);
-        memmove(encoded_val, req_vb_key->content.p.data, encoded_val_size);
+    return handle_oid(builder, &oid, search, NULL);
+}
+
+static bool create_response(resp_builder_t *builder, const snmp_message_t *req, asn1_node_t *resp) {
+    arena_t *arena = builder->arena;
+    asn1_node_t *resp_pdu;
 
-        create_asn1_node(resp_vb, req_vb_key->type, encoded_val, encoded_val_size, true);
+    resp->type = OBJECT_TYPE_SEQUENCE;
+    create_asn1_node(arena, resp, req->version.type, req->version.data, req->version.size);
+    create_asn1_node(arena, resp, req->community.type, req->community.data, req->community.size);
 
-        if (NULL == (mib_entry = search(&oid))) {
+    if (NULL == (resp_pdu = create_asn1_node(arena, resp, REQUEST_TYPE_GETRESPONSE, NULL, 0))) return false;
+
+    create_asn1_node(arena, resp_pdu, req->request_id.type, req->request_id.data, req->request_id.size);
+
+    return create_integer_node(arena, resp_pdu, builder->error_status) &&
+           create_integer_node(arena, resp_pdu, builder->error_index) &&
+           0 == add_asn1_node(arena, resp_pdu, builder->vb_list);
+}
+
+// response what doesn't fit into datagram is replaced by tooBig error with empty varbind list
+static bool create_too_big_response(resp_builder_t *builder, const snmp_message_t *req, asn1_node_t *resp) {
+    if (NULL == (builder->vb_list = create_asn1_node(builder->arena, NULL, OBJECT_TYPE_SEQUENCE, NULL, 0)))
+        return false;
+
+    builder->vb_list_size = 0;
+    builder->error_status = ERROR_STATUS_TOO_BIG;
+    builder->error_index = 0;
+
+    return create_response(builder, req, resp);
+}
+
+/*
+ * Moves request with all memory of arena into parked request, it is finished when all asynchronous values arrive.
+ * Request is parked even if it failed meanwhile, since getters in flight refer to its memory.
+ */
+static bool park_request(resp_builder_t *builder, const snmp_message_t *req, const snmp_peer_t *peer,
+                         bool is_too_big, bool is_failed) {
+    parked_request_t *parked = builder->parked;
+
+    parked->arena = *builder->arena;
+    *builder->arena = (arena_t) { .block_size = builder->arena->block_size };
+
+    parked->builder = *builder;
+    parked->builder.arena = &parked->arena;
+    parked->msg = *req;
+    parked->peer = *peer;
+    parked->is_too_big = is_too_big;
+    parked->is_failed = is_failed;
+
+    errno = EINPROGRESS;
+    return false;
+}
 
+static bool handle_get_request(arena_t *arena, const snmp_message_t *req, asn1_node_t *resp, size_t resp_buffer_size,
+                               search_func_t search, snmp_processor_t *processor, const snmp_peer_t *peer) {
+    ber_cursor_t varbinds = req->varbinds;
+    ber_tlv_t name, value;
+    resp_builder_t builder;
+    int rv;
+
+    init_builder(&builder, arena, req, resp_buffer_size);
+    builder.processor = processor;
+    if (NULL == (builder.vb_list = create_asn1_node(arena, NULL, OBJECT_TYPE_SEQUENCE, NULL, 0))) return false;
+
+    while (0 < (rv = ber_next_varbind(&varbinds, &name, &value))) {
+        if (!handle_varbind(&builder, &name, search)) {
+            if (NULL != builder.parked) return park_request(&builder, req, peer, ENOBUFS == errno, ENOBUFS != errno);
+            if (ENOBUFS == errno) return create_too_big_response(&builder, req, resp);
+            return false;
+        }
+    }
+
+    if (NULL != builder.parked) return park_request(&builder, req, peer, false, 0 != rv);
+
+    // empty varbind list is not allowed, same as in check_non_trap_request()
+    return 0 == rv && builder.vb_list->content.c.items_num > 0 && create_response(&builder, req, resp);
+}
+
+/*
+ * GetBulkRequest: first non-repeaters varbinds are served as GetNextRequest, rest of them are walked in lexicographic
+ * order up to max-repetitions times. Varbinds what don't fit into datagram are dropped instead of tooBig error, which is
+ * reported only if even response with empty varbind list doesn't fit (RFC 3416, 4.2.3).
+ */
+static bool handle_getbulk_request(arena_t *arena, const snmp_message_t *req, asn1_node_t *resp,
+                                   size_t resp_buffer_size) {
+    ber_cursor_t varbinds = req->varbinds;
+    ber_tlv_t name, value;
+    resp_builder_t builder;
+    int non_repeaters = 0, max_repetitions = 0, rv, i;
+    size_t repeaters_cnt = 0, r, ended;
+    oid_t *cursors;
+    const mib_entry_t *found;
+    bool is_cut = false;
+
+    init_builder(&builder, arena, req, resp_buffer_size);
+    if (NULL == (builder.vb_list = create_asn1_node(arena, NULL, OBJECT_TYPE_SEQUENCE, NULL, 0))) return false;
+
+    ber_decode_integer(req->error_status.data, req->error_status.size, &non_repeaters);
+    ber_decode_integer(req->error_index.data, req->error_index.size, &max_repetitions);
+
+    for (i = 0; 0 < (rv = ber_next_varbind(&varbinds, &name, &value)); i++) {
+        if (i < non_repeaters) {
+            // rest of varbinds is still read, so malformed request is rejected anyway
+            if (!is_cut && !handle_varbind(&builder, &name, mib_findnext)) {
+                if (ENOBUFS != errno) return false;
+                is_cut = true;
+            }
         } else {
-            encode_data(mib_entry, &encoded_val, &encoded_val_size);
-            create_asn1_node(resp_vb, mib_entry->type, encoded_val, encoded_val_size, true);
+            repeaters_cnt++;
         }
     }
 
-    resp->type = OBJECT_TYPE_SEQUENCE;
-    add_asn1_node(resp, copy_primitive_asn1_node(pdu_root->content.c.items[0]));
-    add_asn1_node(resp, copy_primitive_asn1_node(pdu_root->content.c.items[1]));
+    if (rv < 0 || 0 == i) return false;
 
-    resp_pdu = create_asn1_node(resp, REQUEST_TYPE_GETRESPONSE, NULL, 0, false);
+    if (is_cut || 0 == repeaters_cnt || 0 == max_repetitions) goto cut;
 
-    add_asn1_node(resp_pdu, copy_primitive_asn1_node(pdu->content.c.items[0]));
-    add_asn1_node(resp_pdu, copy_primitive_asn1_node(pdu->content.c.items[1]));
-    add_asn1_node(resp_pdu, copy_primitive_asn1_node(pdu->content.c.items[2]));
-    add_asn1_node(resp_pdu, resp_vb_list);
+    // every repeater walks from its own position, OIDs point either to request or to MIB
+    if (NULL == (cursors = arena_alloc(arena, repeaters_cnt * sizeof(*cursors)))) return false;
 
-    return true;
+    varbinds = req->varbinds;
+    for (i = 0, r = 0; 0 < ber_next_varbind(&varbinds, &name, &value); i++) {
+        if (i < non_repeaters) continue;
+
+        if (ber_decode_oid(name.data, name.size, &cursors[r++]) < 0) return false;
+    }
+
+    for (i = 0; i < max_repetitions; i++) {
+        for (r = 0, ended = 0; r < repeaters_cnt; r++) {
+            if (!handle_oid(&builder, &cursors[r], mib_findnext, &found)) {
+                if (ENOBUFS == errno) goto cut;
+                return false;
+            }
+
+            if (NULL == found) {
+                ended++;
+            } else {
+                cursors[r] = found->oid;
+            }
+        }
+
+        // nothing left to walk, other repetitions would contain only endOfMibView
+        if (ended == repeaters_cnt) break;
+    }
+
+    cut:
+    if (resp_buffer_size < response_overhead(req)) return create_too_big_response(&builder, req, resp);
+
+    return create_response(&builder, req, resp);
+}
+
+static inline void node_to_tlv(const asn1_node_t *node, ber_tlv_t *tlv) {
+    tlv->type = node->type;
+    tlv->data = node->content.p.data;
+    tlv->size = node->content.p.size;
+}
+
+// same as handle_get_request() but for request validated and decoded into tree by slow path
+static bool handle_decoded_get_request(arena_t *arena, const asn1_node_t *pdu, asn1_node_t *resp,
+                                       size_t resp_buffer_size, search_func_t search) {
+    size_t i;
+    snmp_message_t req = { .pdu_type = pdu->type };
+    const asn1_node_t *req_vb_list = pdu->content.c.items[3];
+    resp_builder_t builder;
+    ber_tlv_t name;
+
+    node_to_tlv(pdu->root->content.c.items[0], &req.version);
+    node_to_tlv(pdu->root->content.c.items[1], &req.community);
+    node_to_tlv(pdu->content.c.items[0], &req.request_id);
+    node_to_tlv(pdu->content.c.items[1], &req.error_status);
+    node_to_tlv(pdu->content.c.items[2], &req.error_index);
+
+    init_builder(&builder, arena, &req, resp_buffer_size);
+    if (NULL == (builder.vb_list = create_asn1_node(arena, NULL, OBJECT_TYPE_SEQUENCE, NULL, 0))) return false;
+
+    for (i = 0; i < req_vb_list->content.c.items_num; i++) {
+        node_to_tlv(req_vb_list->content.c.items[i]->content.c.items[0], &name);
+
+        if (!handle_varbind(&builder, &name, search)) {
+            if (ENOBUFS == errno) return create_too_big_response(&builder, &req, resp);
+            return false;
+        }
+    }
+
+    return create_response(&builder, &req, resp);
+}
+
+// sends response of parked request once all its values arrived or expired
+static void answer_parked(snmp_processor_t *processor, parked_request_t *parked) {
+    asn1_node_t response = {0};
+    uint8_t *packet;
+    ssize_t size;
+    bool res;
+
+    if (!parked->is_failed && !processor->is_closing) {
+        res = parked->is_too_big ? create_too_big_response(&parked->builder, &parked->msg, &response)
+                                 : create_response(&parked->builder, &parked->msg, &response);
+
+        if (res && (size = ber_encode_asn1_tree(&response, processor->buffer, sizeof(processor->buffer), &packet)) > 0) {
+            sendto(parked->peer.sockfd, packet, (size_t) size, MSG_DONTWAIT, (struct sockaddr *) &parked->peer.addr,
+                   parked->peer.addrlen);
+        }
+    }
+}
+
+// getters which missed deadline still refer to memory of request, so it's released once the last one completes
+static void release_parked(parked_request_t *parked) {
+    arena_t arena;
+
+    // parked request itself lives in the arena
+    arena = parked->arena;
+    arena_free(&arena);
+}
+
+/*
+ * Value which didn't arrive in time is reported as missing: noSuchInstance in SNMPv2c, genErr in SNMPv1. Response is
+ * sent without waiting for getter, which completes into resolved varbind later.
+ */
+static void handle_deadline(__attribute__((unused)) event_loop_t *loop, event_timeout_t *timeout) {
+    pending_varbind_t *pending = timeout->user_data;
+    parked_request_t *parked = pending->parked;
+
+    pending->is_resolved = true;
+    deadline_miss(pending->entry);
+
+    if (NULL != pending->value) {
+        if (SNMP_VERSION_1 == parked->builder.version) {
+            set_error_at(&parked->builder, ERROR_STATUS_GEN_ERR, pending->index);
+        } else {
+            pending->value->type = OBJECT_TYPE_NO_INSTANCE;
+        }
+    }
+
+    if (0 == --parked->waiting) answer_parked(parked->processor, parked);
+}
+
+// fills varbind with arrived value, value which doesn't fit into response turns it into tooBig
+static void resolve_varbind(snmp_processor_t *processor, pending_varbind_t *pending, const mib_async_t *async) {
+    parked_request_t *parked = pending->parked;
+    resp_builder_t *builder = &parked->builder;
+    const mib_value_t *value = &async->value;
+    void *data;
+
+    if (pending->is_resolved) goto release;
+
+    pending->is_resolved = true;
+    event_loop_cancel_timeout(processor->loop, &pending->deadline);
+
+    if (NULL != pending->value) {
+        if (0 == async->status && NULL != (data = arena_memdup(&parked->arena, value->data, value->size))) {
+            pending->value->type = pending->entry->type;
+            pending->value->content.p.data = data;
+            pending->value->content.p.size = value->size;
+
+            builder->vb_list_size += varbind_size(pending->name_size, value->size) -
+                                     varbind_size(pending->name_size, 0);
+            if (builder->vb_list_size > builder->size_limit) parked->is_too_big = true;
+
+            if (NULL != pending->entry->cache) cache_put(pending->entry->cache, data, value->size);
+        } else {
+            set_error_at(builder, ERROR_STATUS_GEN_ERR, pending->index);
+        }
+    }
+
+    if (0 == --parked->waiting) answer_parked(processor, parked);
+
+    release:
+    if (0 == --parked->pending) release_parked(parked);
+}
+
+snmp_processor_t *processor_create(event_loop_t *loop) {
+    snmp_processor_t *processor;
+
+    if (NULL == (processor = calloc(1, sizeof(*processor)))) return NULL;
+
+    processor->loop = loop;
+
+    if (-1 == (processor->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))) {
+        free(processor);
+        return NULL;
+    }
+
+    pthread_mutex_init(&processor->lock, NULL);
+
+    return processor;
+}
+
+int processor_fd(const snmp_processor_t *processor) {
+    return processor->eventfd;
 }
 
-ssize_t process_request(const uint8_t *req_packet, size_t req_size, uint8_t **resp_packet) {
+void processor_complete(snmp_processor_t *processor) {
+    mib_async_t *async, *next;
+    uint64_t cnt;
+
+    // counter is reset before list is taken, so later completions wake processor up again
+    if (read(processor->eventfd, &cnt, sizeof(cnt))) {}
+
+    pthread_mutex_lock(&processor->lock);
+    async = processor->completed;
+    processor->completed = NULL;
+    pthread_mutex_unlock(&processor->lock);
+
+    for (; NULL != async; async = next) {
+        next = async->next;
+        resolve_varbind(processor, async->arg, async);
+        mib_async_free(async);
+    }
+}
+
+void processor_free(snmp_processor_t *processor) {
+    if (NULL == processor) return;
+
+    processor->is_closing = true;
+    processor_complete(processor);
+
+    close(processor->eventfd);
+    pthread_mutex_destroy(&processor->lock);
+    free(processor);
+}
+
+ssize_t process_request(arena_t *arena, const uint8_t *req_packet, size_t req_size, uint8_t *resp_buffer,
+                        size_t resp_buffer_size, uint8_t **resp_packet, snmp_processor_t *processor,
+                        const snmp_peer_t *peer) {
     asn1_node_t request, response = {0};
     const asn1_node_t *pdu;
+    snmp_message_t msg;
     *resp_packet = NULL;
-    bool res;
+    bool res = false;
     ssize_t resp_size = -1, bytes_decoded;
 
-    if ((bytes_decoded = ber_decode_asn1_tree(req_packet, req_size, &request)) < 0 ||
+    // parked request refers to its packet after caller reuses buffer
+    if (NULL == peer) {
+        processor = NULL;
+    } else if (NULL != processor && NULL == (req_packet = arena_memdup(arena, req_packet, req_size))) {
+        goto end;
+    }
+
+    // fast path: GetRequest, GetNextRequest and GetBulkRequest are served right from the received packet
+    if (0 == ber_parse_snmp_message(req_packet, req_size, &msg) &&
+        (REQUEST_TYPE_GET == msg.pdu_type || REQUEST_TYPE_GETNEXT == msg.pdu_type ||
+         REQUEST_TYPE_GETBULK == msg.pdu_type)) {
+        if (!check_snmp_message(&msg)) goto end;
+
+        switch (msg.pdu_type) {
+            case REQUEST_TYPE_GET:
+                res = handle_get_request(arena, &msg, &response, resp_buffer_size, mib_find, processor, peer);
+                break;
+            case REQUEST_TYPE_GETNEXT:
+                res = handle_get_request(arena, &msg, &response, resp_buffer_size, mib_findnext, processor, peer);
+                break;
+            default:
+                res = handle_getbulk_request(arena, &msg, &response, resp_buffer_size);
+                break;
+        }
+
+        goto encode;
+    }
+
+    // slow path: all other PDUs are decoded into tree and validated by check strategies
+    if ((bytes_decoded = ber_decode_asn1_tree(arena, req_packet, req_size, &request)) < 0 ||
         (size_t) bytes_decoded != req_size)
-        return -1;
+        goto end;
 
     if (NULL == (pdu = check_snmp_request(&request))) {
-        return -1;
+        goto end;
     }
 
     switch (pdu->type) {
         case REQUEST_TYPE_GET:
-            res = handle_get_request(pdu, &response, mib_find);
+            res = handle_decoded_get_request(arena, pdu, &response, resp_buffer_size, mib_find);
             break;
         case REQUEST_TYPE_GETNEXT:
-            res = handle_get_request(pdu, &response, mib_findnext);
+            res = handle_decoded_get_request(arena, pdu, &response, resp_buffer_size, mib_findnext);
             break;
         default:
-            return -1;
+            goto end;
     }
 
+    encode:
     if (res) {
-        resp_size = ber_encode_asn1_tree(&response, resp_packet);
+        resp_size = ber_encode_asn1_tree(&response, resp_buffer, resp_buffer_size, resp_packet);
     }
 
-    release_asn1_tree(&request);
-    release_asn1_tree(&response);
+    end:
+    arena_reset(arena);
 
     return resp_size;
 }
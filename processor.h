@@ -21,7 +21,47 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <sys/socket.h>
 
-ssize_t process_request(const uint8_t *req_packet, size_t req_size, uint8_t **resp_packet);
+#include "arena.h"
+#include "event_loop.h"
+
+// maximum payload of UDP datagram, any response fits into buffer of this size
+#define SNMP_MAX_DATAGRAM_SIZE 65507
+
+// client request came from, response of parked request is sent there
+typedef struct snmp_peer {
+    int sockfd;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+} snmp_peer_t;
+
+/*
+ * Keeps requests parked while their values are obtained by asynchronous getters, see mib_get_async(). Processor is
+ * used by single thread, completions of any thread wake it up through descriptor returned by processor_fd(), then
+ * processor_complete() sends responses of requests which values have all arrived. Values which don't arrive before
+ * their deadline, see deadline_get(), are reported as missing by timeouts of loop, so response isn't held up by them.
+ */
+typedef struct snmp_processor snmp_processor_t;
+
+snmp_processor_t *processor_create(event_loop_t *loop);
+int processor_fd(const snmp_processor_t *processor);
+void processor_complete(snmp_processor_t *processor);
+
+// must be called after sources of asynchronous values are stopped and before loop is freed, responses are dropped
+void processor_free(snmp_processor_t *processor);
+
+/*
+ * Response is encoded into resp_buffer from its end, on success resp_packet points to the beginning of response inside
+ * of resp_buffer and its size is returned. All memory needed to process request is taken from arena what is reset
+ * before return, so every thread must use its own arena and buffers.
+ *
+ * If processor is given, GetRequest and GetNextRequest wait for values of asynchronous getters without blocking the
+ * caller: request is parked, -1 is returned with errno set to EINPROGRESS and response is sent to peer later by
+ * processor_complete(). Memory of parked request is taken away from arena, so arena stays usable.
+ */
+ssize_t process_request(arena_t *arena, const uint8_t *req_packet, size_t req_size, uint8_t *resp_buffer,
+                        size_t resp_buffer_size, uint8_t **resp_packet, snmp_processor_t *processor,
+                        const snmp_peer_t *peer);
 
 #endif //SNMP_SNMP_H
@@ -0,0 +1,845 @@
+/*
+ * script.c
+ * Copyright (c) 2020 Sergei Kosivchenko <archichief@gmail.com>
+ *
+ * smart-snmp is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * smart-snmp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "script.h"
+#include "utilities.h"
+
+typedef struct script script_t;
+typedef struct script_call script_call_t;
+
+// request sent to co-process, answers come in the same order as requests
+struct script_call {
+    mib_async_t *async;                         // NULL for synchronous call
+    char *answer;                               // answer line of synchronous call
+    int rv;                                     // 0 if answer is received
+    bool is_done;
+    struct timespec sent;
+    script_call_t *next;
+};
+
+struct script {
+    char *path;
+    char *oid;                                  // OID in dotted form as it is sent to co-process
+    object_type_t type;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;                        // signaled when synchronous calls are done
+    pid_t pid;                                  // co-process, -1 if it is not started
+    int fd;                                     // socket connected to stdin and stdout of co-process
+    script_call_t *head;                        // calls waiting for answers, the oldest first
+    script_call_t *tail;
+
+    char buf[SNMP_SCRIPT_LINE_MAX];             // read but not consumed answers
+    size_t buf_len;
+
+    script_t *next;
+};
+
+static script_t *scripts;
+
+// answers of all co-processes are read by single thread, so nobody waits for co-process with worker blocked
+static struct {
+    pthread_t thread;
+    int epfd;
+    int wakefd;                                 // eventfd waking thread up to take new deadline or to stop
+    bool is_started;
+    atomic_bool is_stopped;
+} io = { .epfd = -1, .wakefd = -1 };
+
+static long elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+// starts script with given argument, its stdin and stdout are connected to returned socket
+static int spawn(const char *path, const char *arg, pid_t *pid) {
+    sigset_t sigmask;
+    int fds[2];
+
+    if (-1 == socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds)) return -1;
+
+    if (-1 == (*pid = fork())) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    if (0 == *pid) {
+        // only async-signal-safe calls are allowed in child of multithreaded process, signals blocked by workers
+        // must not be inherited by script
+        sigemptyset(&sigmask);
+        sigprocmask(SIG_SETMASK, &sigmask, NULL);
+
+        dup2(fds[1], STDIN_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        execl(path, path, arg, (char *) NULL);
+        _exit(127);
+    }
+
+    close(fds[1]);
+
+    return fds[0];
+}
+
+static int parse_status(const char *answer, const char **value) {
+    long status;
+    char *end;
+
+    errno = 0;
+    status = strtol(answer, &end, 10);
+
+    if (end == answer || errno || status < 0 || status > INT_MAX || (*end && ' ' != *end)) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    *value = *end ? end + 1 : end;
+
+    return (int) status;
+}
+
+static int parse_value(const char *str, mib_value_t *value) {
+    unsigned long long uval;
+    long long val;
+    char *end;
+    oid_t oid;
+
+    switch (value->type) {
+        case OBJECT_TYPE_INTEGER:
+            errno = 0;
+            val = strtoll(str, &end, 10);
+
+            if (end == str || *end || errno) break;
+            return mib_value_set_integer(value, val);
+        case OBJECT_TYPE_COUNTER:
+        case OBJECT_TYPE_GAUGE:
+        case OBJECT_TYPE_TIMETICKS:
+        case OBJECT_TYPE_COUNTER64:
+            // strtoull() accepts negative values
+            errno = 0;
+            uval = strtoull(str, &end, 10);
+
+            if ('-' == *str || end == str || *end || errno) break;
+            return mib_value_set_unsigned(value, uval);
+        case OBJECT_TYPE_OCTET_STRING:
+            return mib_value_set_bytes(value, str, strlen(str));
+        case OBJECT_TYPE_OID:
+            if (0 != string_to_oid(value->arena, str, &oid)) return -1;
+            return mib_value_set_oid(value, &oid);
+        default:
+            break;
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+// called with lock held, answer is NULL if call failed
+static void finish_call(script_call_t *call, const char *answer) {
+    const char *value;
+
+    if (NULL != call->async) {
+        // value of get is parsed right away, so answer isn't kept
+        mib_async_complete(call->async, NULL != answer && 0 == parse_status(answer, &value) &&
+                                        0 == parse_value(value, mib_async_value(call->async)) ? 0 : -1);
+        free(call);
+        return;
+    }
+
+    if (NULL != answer) strcpy(call->answer, answer);
+
+    call->rv = NULL != answer ? 0 : -1;
+    call->is_done = true;
+}
+
+// called with lock held, all calls in flight fail
+static void stop_coprocess(script_t *s) {
+    script_call_t *call;
+
+    if (-1 != s->pid) {
+        kill(s->pid, SIGKILL);
+        waitpid(s->pid, NULL, 0);
+    }
+
+    // closed descriptor leaves epoll set by itself
+    if (-1 != s->fd) close(s->fd);
+
+    s->pid = -1;
+    s->fd = -1;
+    s->buf_len = 0;
+
+    while (NULL != (call = s->head)) {
+        s->head = call->next;
+        finish_call(call, NULL);
+    }
+
+    s->tail = NULL;
+    pthread_cond_broadcast(&s->cond);
+}
+
+static void wake_io() {
+    uint64_t one = 1;
+
+    // counter overflow means thread is already woken up
+    if (write(io.wakefd, &one, sizeof(one))) {}
+}
+
+/*
+ * Sends request to co-process, which is started if needed, and queues call for answer. Requests of concurrent callers
+ * are written right away, so co-process can work on them while answers of previous ones are read. Call is finished
+ * by I/O thread when answer comes, or at once if co-process fails. Returns -1 only if call isn't queued.
+ */
+static int send_call(script_t *s, const char *request, size_t request_len, script_call_t *call) {
+    struct epoll_event ev = { .events = EPOLLIN };
+    bool was_idle;
+
+    if (-1 == s->fd) {
+        if (-1 == (s->fd = spawn(s->path, "serve", &s->pid))) return -1;
+
+        ev.data.ptr = s;
+        if (-1 == epoll_ctl(io.epfd, EPOLL_CTL_ADD, s->fd, &ev)) {
+            stop_coprocess(s);
+            return -1;
+        }
+    }
+
+    was_idle = NULL == s->head;
+    clock_gettime(CLOCK_MONOTONIC, &call->sent);
+    call->next = NULL;
+
+    if (NULL != s->tail) {
+        s->tail->next = call;
+    } else {
+        s->head = call;
+    }
+
+    s->tail = call;
+
+    // requests are short, socket buffer is full only if co-process is stuck
+    if ((ssize_t) request_len != send(s->fd, request, request_len, MSG_NOSIGNAL | MSG_DONTWAIT)) {
+        stop_coprocess(s);
+        return 0;
+    }
+
+    // I/O thread may sleep without deadline while no call is waiting
+    if (was_idle) wake_io();
+
+    return 0;
+}
+
+// sends request and waits for answer, returns error-status from answer or -1 if co-process can't be reached
+static int call(script_t *s, const char *request, size_t request_len, char *answer, const char **value) {
+    script_call_t call = { .answer = answer };
+    int rv = -1;
+
+    pthread_mutex_lock(&s->lock);
+
+    if (0 == send_call(s, request, request_len, &call)) {
+        while (!call.is_done) pthread_cond_wait(&s->cond, &s->lock);
+
+        if (0 == call.rv) rv = parse_status(answer, value);
+    }
+
+    pthread_mutex_unlock(&s->lock);
+
+    return rv;
+}
+
+// reads available answers of co-process and finishes their calls
+static void read_answers(script_t *s) {
+    script_call_t *call;
+    ssize_t rv;
+    char *eol, *line;
+    size_t len;
+
+    pthread_mutex_lock(&s->lock);
+
+    while (-1 != s->fd) {
+        if ((rv = recv(s->fd, s->buf + s->buf_len, sizeof(s->buf) - s->buf_len, MSG_DONTWAIT)) <= 0) {
+            if (rv < 0 && EINTR == errno) continue;
+            if (rv < 0 && EAGAIN == errno) break;
+
+            stop_coprocess(s);
+            break;
+        }
+
+        s->buf_len += (size_t) rv;
+        line = s->buf;
+
+        while (NULL != (eol = memchr(line, '\n', s->buf_len - (size_t) (line - s->buf)))) {
+            // answer nobody asked for breaks order of the following ones
+            if (NULL == (call = s->head)) break;
+
+            *eol = '\0';
+            if (NULL == (s->head = call->next)) s->tail = NULL;
+            finish_call(call, line);
+            line = eol + 1;
+        }
+
+        len = s->buf_len - (size_t) (line - s->buf);
+
+        if (NULL != eol || len == sizeof(s->buf)) {
+            stop_coprocess(s);
+            break;
+        }
+
+        memmove(s->buf, line, len);
+        s->buf_len = len;
+    }
+
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+}
+
+// restarts co-processes what don't answer in time, returns time left until the nearest deadline or -1
+static int expire_calls() {
+    long left, timeout = -1;
+    script_t *s;
+
+    for (s = scripts; NULL != s; s = s->next) {
+        pthread_mutex_lock(&s->lock);
+
+        if (NULL != s->head) {
+            if ((left = SNMP_SCRIPT_TIMEOUT_MS - elapsed_ms(&s->head->sent)) <= 0) {
+                stop_coprocess(s);
+            } else if (timeout < 0 || left < timeout) {
+                timeout = left;
+            }
+        }
+
+        pthread_mutex_unlock(&s->lock);
+    }
+
+    return (int) timeout;
+}
+
+static void *io_routine(void *arg) {
+    struct epoll_event events[16];
+    uint64_t cnt;
+    int n, i;
+
+    (void) arg;
+
+    while (!atomic_load(&io.is_stopped)) {
+        if (-1 == (n = epoll_wait(io.epfd, events, sizeof(events) / sizeof(*events), expire_calls()))) n = 0;
+
+        for (i = 0; i < n; i++) {
+            if (NULL == events[i].data.ptr) {
+                if (read(io.wakefd, &cnt, sizeof(cnt))) {}
+            } else {
+                read_answers(events[i].data.ptr);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static int start_io() {
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    int rv;
+
+    if (-1 == (io.epfd = epoll_create1(EPOLL_CLOEXEC)) ||
+        -1 == (io.wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) ||
+        -1 == epoll_ctl(io.epfd, EPOLL_CTL_ADD, io.wakefd, &ev)) {
+        return -1;
+    }
+
+    atomic_store(&io.is_stopped, false);
+
+    if (0 != (rv = pthread_create(&io.thread, NULL, io_routine, NULL))) {
+        errno = rv;
+        return -1;
+    }
+
+    io.is_started = true;
+
+    return 0;
+}
+
+static void stop_io() {
+    if (io.is_started) {
+        atomic_store(&io.is_stopped, true);
+        wake_io();
+        pthread_join(io.thread, NULL);
+        io.is_started = false;
+    }
+
+    if (-1 != io.epfd) close(io.epfd);
+    if (-1 != io.wakefd) close(io.wakefd);
+
+    io.epfd = io.wakefd = -1;
+}
+
+static int script_get(void *data, mib_value_t *value) {
+    script_t *s = data;
+    char request[SNMP_SCRIPT_LINE_MAX], answer[SNMP_SCRIPT_LINE_MAX];
+    const char *val;
+    int len = snprintf(request, sizeof(request), "get %s\n", s->oid);
+
+    if (0 != call(s, request, (size_t) len, answer, &val)) return -1;
+
+    return parse_value(val, value);
+}
+
+// request waits for answer without blocking worker
+static int script_get_async(void *data, mib_async_t *async) {
+    script_t *s = data;
+    char request[SNMP_SCRIPT_LINE_MAX];
+    script_call_t *call;
+    int len = snprintf(request, sizeof(request), "get %s\n", s->oid), rv;
+
+    if (NULL == (call = calloc(1, sizeof(*call)))) return -1;
+
+    call->async = async;
+
+    pthread_mutex_lock(&s->lock);
+    rv = send_call(s, request, (size_t) len, call);
+    pthread_mutex_unlock(&s->lock);
+
+    if (0 != rv) free(call);
+
+    return rv;
+}
+
+static int script_set(void *data, const void *res, size_t size) {
+    script_t *s = data;
+    char request[SNMP_SCRIPT_LINE_MAX], answer[SNMP_SCRIPT_LINE_MAX];
+    const char *val;
+    char *str;
+    int len, status;
+
+    switch (s->type) {
+        case OBJECT_TYPE_INTEGER:
+            len = snprintf(request, sizeof(request), "set %s %d\n", s->oid, *(const int *) res);
+            break;
+        case OBJECT_TYPE_OCTET_STRING:
+            // answers and requests are framed by lines
+            if (NULL != memchr(res, '\n', size) || size > INT_MAX) return ERROR_STATUS_BAD_VALUE;
+
+            len = snprintf(request, sizeof(request), "set %s %.*s\n", s->oid, (int) size, (const char *) res);
+            break;
+        case OBJECT_TYPE_OID:
+            if (NULL == (str = oid_to_string(res))) return ERROR_STATUS_GEN_ERR;
+
+            len = snprintf(request, sizeof(request), "set %s %s\n", s->oid, str + 1);
+            free(str);
+            break;
+        default:
+            return ERROR_STATUS_GEN_ERR;
+    }
+
+    if (len < 0 || (size_t) len >= sizeof(request)) return ERROR_STATUS_BAD_VALUE;
+
+    if ((status = call(s, request, (size_t) len, answer, &val)) < 0) return ERROR_STATUS_GEN_ERR;
+
+    return status;
+}
+
+static script_t *create_script(const char *path, const char *oid, object_type_t type) {
+    script_t *s;
+
+    if (NULL == (s = calloc(1, sizeof(*s)))) return NULL;
+
+    s->path = strdup(path);
+    s->oid = strdup('.' == *oid ? oid + 1 : oid);
+    s->type = type;
+    s->pid = -1;
+    s->fd = -1;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+
+    s->next = scripts;
+    scripts = s;
+
+    if (NULL == s->path || NULL == s->oid) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return s;
+}
+
+// script found in directory, its OID and type are taken from discovery cache or obtained by running it
+typedef struct discovery {
+    char *path;
+    struct timespec mtime;
+    off_t size;
+    char *oid;
+    char *type;
+    bool is_cached;
+    bool is_failed;
+} discovery_t;
+
+// method of script run during discovery
+typedef struct discovery_job {
+    discovery_t *item;
+    char **res;
+    pid_t pid;
+    int fd;
+    struct timespec start;
+    size_t len;
+    char out[SNMP_SCRIPT_LINE_MAX];
+} discovery_job_t;
+
+static int compare_discoveries(const void *a, const void *b) {
+    return strcmp(((const discovery_t *) a)->path, ((const discovery_t *) b)->path);
+}
+
+static char *arena_strdup(arena_t *arena, const char *str) {
+    return arena_memdup(arena, str, strlen(str) + 1);
+}
+
+// collects executable scripts sorted by path, so the same script is registered first on every start
+static ssize_t scan(const char *dir, arena_t *arena, discovery_t **items) {
+    char path[PATH_MAX];
+    discovery_t *tmp;
+    size_t cnt = 0, cap = 0, len;
+    struct dirent *de;
+    struct stat st;
+    DIR *d;
+    int rv;
+
+    *items = NULL;
+
+    if (NULL == (d = opendir(dir))) return -1;
+
+    while (NULL != (de = readdir(d))) {
+        len = strlen(de->d_name);
+
+        // Lua scripts are embedded, see lua_handlers_load()
+        if ('.' == de->d_name[0] || (len >= 4 && 0 == strcmp(de->d_name + len - 4, ".lua"))) continue;
+
+        if ((size_t) snprintf(path, sizeof(path), "%s/%s", dir, de->d_name) >= sizeof(path)) {
+            errno = ENAMETOOLONG;
+            goto fail;
+        }
+
+        if (0 != stat(path, &st) || !S_ISREG(st.st_mode) || 0 != access(path, X_OK)) continue;
+
+        if (cnt == cap) {
+            cap = cap ? cap * 2 : 64;
+            if (NULL == (tmp = realloc(*items, cap * sizeof(*tmp)))) goto fail;
+            *items = tmp;
+        }
+
+        memset(&(*items)[cnt], 0, sizeof(**items));
+        (*items)[cnt].mtime = st.st_mtim;
+        (*items)[cnt].size = st.st_size;
+        if (NULL == ((*items)[cnt++].path = arena_strdup(arena, path))) goto fail;
+    }
+
+    closedir(d);
+    qsort(*items, cnt, sizeof(**items), compare_discoveries);
+
+    return (ssize_t) cnt;
+
+    fail:
+    rv = errno;
+    closedir(d);
+    free(*items);
+    *items = NULL;
+    errno = rv;
+
+    return -1;
+}
+
+/*
+ * Takes OIDs and types of scripts what weren't changed since they were cached. Every line of cache is
+ *     <mtime seconds>.<mtime nanoseconds> <size> <type> <oid> <path>
+ * Missing or damaged cache isn't an error, scripts are just run again.
+ */
+static void load_cache(const char *cache_path, arena_t *arena, discovery_t *items, size_t cnt) {
+    char line[PATH_MAX + 4096 + 128], type[32], oid[4096];
+    long long sec, nsec, size;
+    discovery_t key, *item;
+    size_t len;
+    FILE *f;
+    int pos;
+
+    if (NULL == (f = fopen(cache_path, "r"))) return;
+
+    while (NULL != fgets(line, sizeof(line), f)) {
+        len = strlen(line);
+        if (0 == len || '\n' != line[len - 1]) continue;
+        line[len - 1] = '\0';
+
+        pos = 0;
+        if (5 != sscanf(line, "%lld.%lld %lld %31s %4095s %n", &sec, &nsec, &size, type, oid, &pos) || 0 == pos ||
+            '\0' == line[pos]) {
+            continue;
+        }
+
+        key.path = line + pos;
+        if (NULL == (item = bsearch(&key, items, cnt, sizeof(*items), compare_discoveries))) continue;
+
+        if (item->mtime.tv_sec != sec || item->mtime.tv_nsec != nsec || item->size != size) continue;
+
+        item->type = arena_strdup(arena, type);
+        item->oid = arena_strdup(arena, oid);
+        item->is_cached = NULL != item->type && NULL != item->oid;
+    }
+
+    fclose(f);
+}
+
+// cache is replaced at once, so concurrently starting agent never reads half-written file
+static int save_cache(const char *cache_path, const discovery_t *items, size_t cnt) {
+    char tmp_path[PATH_MAX];
+    size_t i;
+    FILE *f;
+    int rv;
+
+    if ((size_t) snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache_path) >= sizeof(tmp_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    if (NULL == (f = fopen(tmp_path, "w"))) return -1;
+
+    for (i = 0; i < cnt; i++) {
+        fprintf(f, "%lld.%09ld %lld %s %s %s\n", (long long) items[i].mtime.tv_sec, items[i].mtime.tv_nsec,
+                (long long) items[i].size, items[i].type, items[i].oid, items[i].path);
+    }
+
+    if (0 != fclose(f) || 0 != rename(tmp_path, cache_path)) {
+        rv = errno;
+        unlink(tmp_path);
+        errno = rv;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int start_job(discovery_job_t *job, discovery_t *item, const char *method, char **res) {
+    if (-1 == (job->fd = spawn(item->path, method, &job->pid))) return -1;
+
+    // script gets nothing on stdin
+    shutdown(job->fd, SHUT_WR);
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+
+    job->item = item;
+    job->res = res;
+    job->len = 0;
+
+    return 0;
+}
+
+// collects output of method which has finished, failed or timed out
+static void finish_job(discovery_job_t *job, arena_t *arena, bool is_failed) {
+    int status;
+
+    close(job->fd);
+
+    if (is_failed) kill(job->pid, SIGKILL);
+    waitpid(job->pid, &status, 0);
+
+    while (job->len && ('\n' == job->out[job->len - 1] || ' ' == job->out[job->len - 1])) job->len--;
+    job->out[job->len] = '\0';
+
+    if (is_failed || !WIFEXITED(status) || 0 != WEXITSTATUS(status) ||
+        NULL == (*job->res = arena_strdup(arena, job->out))) {
+        job->item->is_failed = true;
+    }
+}
+
+// reads available output of job, returns true if job is over
+static bool read_job(discovery_job_t *job, arena_t *arena) {
+    ssize_t rv;
+
+    rv = recv(job->fd, job->out + job->len, sizeof(job->out) - 1 - job->len, MSG_DONTWAIT);
+
+    if (rv < 0 && (EAGAIN == errno || EINTR == errno)) return false;
+
+    if (rv > 0) {
+        // line what doesn't fit into buffer can't be valid OID or type
+        if ((job->len += (size_t) rv) < sizeof(job->out) - 1) return false;
+        rv = -1;
+    }
+
+    finish_job(job, arena, rv < 0);
+
+    return true;
+}
+
+/*
+ * Runs "oid" and "type" methods of scripts what aren't cached, up to SNMP_SCRIPT_DISCOVERY_JOBS processes at once.
+ * Every method must finish in SNMP_SCRIPT_TIMEOUT_MS. Returns number of started methods.
+ */
+static ssize_t discover(discovery_t *items, size_t cnt, arena_t *arena) {
+    discovery_job_t *jobs;
+    struct pollfd pfds[SNMP_SCRIPT_DISCOVERY_JOBS];
+    size_t next = 0, active = 0, i, started = 0;
+    long timeout, left;
+    discovery_t *item;
+    int rv;
+
+    if (NULL == (jobs = malloc(SNMP_SCRIPT_DISCOVERY_JOBS * sizeof(*jobs)))) return -1;
+
+    while (next < 2 * cnt || active) {
+        for (; active < SNMP_SCRIPT_DISCOVERY_JOBS && next < 2 * cnt; next++) {
+            item = &items[next / 2];
+            if (item->is_cached) continue;
+
+            if (0 != start_job(&jobs[active], item, next % 2 ? "type" : "oid", next % 2 ? &item->type : &item->oid)) {
+                item->is_failed = true;
+                continue;
+            }
+
+            active++;
+            started++;
+        }
+
+        for (i = 0, timeout = SNMP_SCRIPT_TIMEOUT_MS; i < active; i++) {
+            pfds[i].fd = jobs[i].fd;
+            pfds[i].events = POLLIN;
+            pfds[i].revents = 0;
+
+            if ((left = SNMP_SCRIPT_TIMEOUT_MS - elapsed_ms(&jobs[i].start)) < timeout) timeout = left > 0 ? left : 0;
+        }
+
+        if (0 == active) continue;
+
+        if (-1 == (rv = poll(pfds, active, (int) timeout)) && EINTR != errno) {
+            for (i = 0; i < active; i++) finish_job(&jobs[i], arena, true);
+            free(jobs);
+            return -1;
+        }
+
+        // finished jobs are replaced by the last ones
+        for (i = active; i-- > 0;) {
+            if (pfds[i].revents ? read_job(&jobs[i], arena) : elapsed_ms(&jobs[i].start) >= SNMP_SCRIPT_TIMEOUT_MS) {
+                if (!pfds[i].revents) finish_job(&jobs[i], arena, true);
+                jobs[i] = jobs[--active];
+            }
+        }
+    }
+
+    free(jobs);
+
+    return (ssize_t) started;
+}
+
+ssize_t scripts_load(const char *dir, const char *cache_path) {
+    arena_t arena = { .block_size = 4096 };
+    mib_entry_t entry = { 0 };
+    discovery_t *items;
+    object_type_t type;
+    ssize_t cnt, discovered;
+    size_t i;
+    script_t *s;
+    oid_t oid;
+    int rv;
+
+    if ((cnt = scan(dir, &arena, &items)) < 0) {
+        arena_free(&arena);
+        return -1;
+    }
+
+    if (NULL != cache_path) load_cache(cache_path, &arena, items, (size_t) cnt);
+
+    if ((discovered = discover(items, (size_t) cnt, &arena)) < 0) goto fail;
+
+    for (i = 0; i < (size_t) cnt; i++) {
+        if (items[i].is_failed) {
+            fprintf(stderr, "Script %s doesn't report its OID or type\n", items[i].path);
+            errno = ECHILD;
+            goto fail;
+        }
+    }
+
+    for (i = 0; i < (size_t) cnt; i++) {
+        if (0 != string_to_oid(&arena, items[i].oid, &oid) || 0 != string_to_type(items[i].type, &type)) {
+            fprintf(stderr, "Script %s reports invalid OID '%s' or type '%s'\n", items[i].path, items[i].oid,
+                    items[i].type);
+            errno = EINVAL;
+            goto fail;
+        }
+
+        if (NULL == (s = create_script(items[i].path, items[i].oid, type))) goto fail;
+
+        // OIDs handled twice are reported by mib_build_index() with paths of both scripts
+        entry.oid = oid;
+        entry.type = type;
+        entry.get_value = script_get;
+        entry.get_async = script_get_async;
+        entry.set = script_set;
+        entry.data = s;
+        entry.origin = s->path;
+
+        if (0 != mib_add_entries(&entry, 1)) goto fail;
+    }
+
+    if (cnt && 0 != start_io()) goto fail;
+
+    // agent works without cache, it only starts slower next time
+    if (NULL != cache_path && discovered && 0 != save_cache(cache_path, items, (size_t) cnt)) {
+        fprintf(stderr, "Can't save discovery cache %s: %s\n", cache_path, strerror(errno));
+    }
+
+    free(items);
+    arena_free(&arena);
+
+    return cnt;
+
+    fail:
+    rv = errno;
+    free(items);
+    arena_free(&arena);
+    errno = rv;
+
+    return -1;
+}
+
+void scripts_free() {
+    script_t *s;
+
+    stop_io();
+
+    while (NULL != (s = scripts)) {
+        scripts = s->next;
+
+        stop_coprocess(s);
+        pthread_mutex_destroy(&s->lock);
+        pthread_cond_destroy(&s->cond);
+        free(s->path);
+        free(s->oid);
+        free(s);
+    }
+}
@@ -0,0 +1,62 @@
+/*
+ * script.h
+ * Copyright (c) 2020 Sergei Kosivchenko <archichief@gmail.com>
+ *
+ * smart-snmp is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * smart-snmp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SNMP_SCRIPT_H
+#define SNMP_SCRIPT_H
+
+#include <sys/types.h>
+
+#include "mib.h"
+
+#ifndef SNMP_SCRIPT_LINE_MAX
+#define SNMP_SCRIPT_LINE_MAX 4096
+#endif
+
+#ifndef SNMP_SCRIPT_TIMEOUT_MS
+#define SNMP_SCRIPT_TIMEOUT_MS 1000
+#endif
+
+// scripts run at once during discovery
+#ifndef SNMP_SCRIPT_DISCOVERY_JOBS
+#define SNMP_SCRIPT_DISCOVERY_JOBS 16
+#endif
+
+/*
+ * Scans directory for executable scripts, asks every script for its OID and type ("<script> oid", "<script> type")
+ * and registers it in MIB. Scripts are asked in parallel, up to SNMP_SCRIPT_DISCOVERY_JOBS at once, and every answer
+ * must come in SNMP_SCRIPT_TIMEOUT_MS. Fails if some script doesn't answer.
+ *
+ * If cache_path isn't NULL, answers are kept in that file and scripts what have the same path, modification time
+ * and size on the next start aren't run again. Missing or damaged cache is ignored.
+ *
+ * Values are served by co-process: script is started once as "<script> serve" on first request and reads requests
+ * line by line from stdin:
+ *     get <oid>
+ *     set <oid> <value>
+ * and answers every request with line "<error-status> [value]" to stdout in the same order. Requests of concurrent
+ * workers are pipelined, co-process what dies or doesn't answer in SNMP_SCRIPT_TIMEOUT_MS is restarted. Answers are
+ * read by single thread, so get requests can wait for them asynchronously, see mib_get_async().
+ *
+ * Returns number of registered scripts.
+ */
+ssize_t scripts_load(const char *dir, const char *cache_path);
+
+// stops all co-processes, asynchronous gets in flight fail, must be called after workers are stopped
+void scripts_free();
+
+#endif //SNMP_SCRIPT_H
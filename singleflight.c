@@ -0,0 +1,157 @@
+/*
+ * singleflight.c
+ * Copyright (c) 2020 Sergei Kosivchenko <archichief@gmail.com>
+ *
+ * smart-snmp is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * smart-snmp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "singleflight.h"
+
+typedef struct flight flight_t;
+
+// getter call in progress, owned by its caller and all waiters, the last one frees it
+struct flight {
+    const mib_entry_t *entry;
+    bool is_finished;
+    int status;
+    uint8_t *val;                               // result copy, made only if somebody waits for it
+    size_t val_size;
+    size_t refs;
+    flight_t *next;
+};
+
+// only entries with getter calls in progress are kept, so table is small and striped to reduce contention
+typedef struct bucket {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;                        // shared by all flights of bucket
+    flight_t *flights;
+} bucket_t;
+
+static bucket_t buckets[SNMP_SINGLEFLIGHT_BUCKETS];
+static pthread_once_t buckets_once = PTHREAD_ONCE_INIT;
+
+static void init_buckets() {
+    size_t i;
+
+    for (i = 0; i < SNMP_SINGLEFLIGHT_BUCKETS; i++) {
+        pthread_mutex_init(&buckets[i].lock, NULL);
+        pthread_cond_init(&buckets[i].cond, NULL);
+    }
+}
+
+// entries of subtree instances are created by every lookup, so they are told apart by OID
+static inline bool is_same_entry(const mib_entry_t *a, const mib_entry_t *b) {
+    if (NULL == a->instance || NULL == b->instance) return a == b;
+
+    return a->subtree == b->subtree && a->data == b->data && 0 == oid_compare(&a->oid, &b->oid);
+}
+
+static bucket_t *get_bucket(const mib_entry_t *entry) {
+    if (NULL == entry->instance) return &buckets[((uintptr_t) entry / sizeof(*entry)) % SNMP_SINGLEFLIGHT_BUCKETS];
+
+    return &buckets[oid_hash(&entry->oid) % SNMP_SINGLEFLIGHT_BUCKETS];
+}
+
+static void release_flight(flight_t *flight) {
+    if (0 != --flight->refs) return;
+
+    free(flight->val);
+    free(flight);
+}
+
+// waits for flight started by other caller, called with bucket lock held
+static int join_flight(bucket_t *bucket, flight_t *flight, arena_t *arena, void **val, size_t *val_size) {
+    int status;
+
+    flight->refs++;
+
+    while (!flight->is_finished) {
+        pthread_cond_wait(&bucket->cond, &bucket->lock);
+    }
+
+    status = flight->status;
+
+    if (ERROR_STATUS_NO_ERROR == status) {
+        // value which can't be copied is reported like failed getter
+        if (NULL == flight->val || NULL == (*val = arena_memdup(arena, flight->val, flight->val_size))) {
+            status = ERROR_STATUS_GEN_ERR;
+        } else {
+            *val_size = flight->val_size;
+        }
+    }
+
+    release_flight(flight);
+
+    return status;
+}
+
+int singleflight_get_encoded(arena_t *arena, const mib_entry_t *entry, void **val, size_t *val_size) {
+    bucket_t *bucket;
+    flight_t *flight, **pos;
+    int status;
+
+    pthread_once(&buckets_once, init_buckets);
+    bucket = get_bucket(entry);
+
+    pthread_mutex_lock(&bucket->lock);
+
+    for (flight = bucket->flights; NULL != flight; flight = flight->next) {
+        if (is_same_entry(flight->entry, entry)) {
+            status = join_flight(bucket, flight, arena, val, val_size);
+            pthread_mutex_unlock(&bucket->lock);
+            return status;
+        }
+    }
+
+    // nobody can share result if flight can't be registered, getter is simply called
+    if (NULL == (flight = calloc(1, sizeof(*flight)))) {
+        pthread_mutex_unlock(&bucket->lock);
+        return mib_get_encoded(arena, entry, val, val_size);
+    }
+
+    flight->entry = entry;
+    flight->refs = 1;
+    flight->next = bucket->flights;
+    bucket->flights = flight;
+
+    pthread_mutex_unlock(&bucket->lock);
+
+    status = mib_get_encoded(arena, entry, val, val_size);
+
+    pthread_mutex_lock(&bucket->lock);
+
+    // callers coming from now on start new flight
+    for (pos = &bucket->flights; *pos != flight; pos = &(*pos)->next);
+    *pos = flight->next;
+
+    flight->is_finished = true;
+    flight->status = status;
+
+    if (flight->refs > 1 && ERROR_STATUS_NO_ERROR == status && NULL != (flight->val = malloc(*val_size))) {
+        memcpy(flight->val, *val, *val_size);
+        flight->val_size = *val_size;
+    }
+
+    pthread_cond_broadcast(&bucket->cond);
+    release_flight(flight);
+
+    pthread_mutex_unlock(&bucket->lock);
+
+    return status;
+}
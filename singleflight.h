@@ -0,0 +1,35 @@
+/*
+ * singleflight.h
+ * Copyright (c) 2020 Sergei Kosivchenko <archichief@gmail.com>
+ *
+ * smart-snmp is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * smart-snmp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SNMP_SINGLEFLIGHT_H
+#define SNMP_SINGLEFLIGHT_H
+
+#include "arena.h"
+#include "mib.h"
+
+#ifndef SNMP_SINGLEFLIGHT_BUCKETS
+#define SNMP_SINGLEFLIGHT_BUCKETS 64
+#endif
+
+/*
+ * Same as mib_get_encoded(), but concurrent callers asking for the same entry don't call its getter again: they wait
+ * for getter call which is already in flight and get copy of its result.
+ */
+int singleflight_get_encoded(arena_t *arena, const mib_entry_t *entry, void **val, size_t *val_size);
+
+#endif //SNMP_SINGLEFLIGHT_H
@@ -0,0 +1,358 @@
+/*
+ * bench.c
+ * Copyright (c) 2020 Sergei Kosivchenko <archichief@gmail.com>
+ *
+ * smart-snmp is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * smart-snmp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "mib.h"
+#include "script.h"
+#include "utilities.h"
+#ifdef SNMP_WITH_LUA
+#include "lua_handlers.h"
+#endif
+
+/*
+ * Measures MIB loading and lookups, OID codecs and per-call cost of script handlers, and checks every result on the
+ * way, so it fails like a test if they are wrong. Every argument is a MIB size, default is small enough for ctest:
+ *     bench 10000 100000 1000000
+ * MIB mixes interface table columns with deep enterprise OIDs of 12-19 arcs.
+ */
+
+#define DEFAULT_ENTRIES 10000
+#define LOOKUPS 1000000
+#define SHELL_CALLS 200
+#define LUA_CALLS 100000
+
+#define CHECK(cond) do {                                                                \
+    if (!(cond)) {                                                                      \
+        fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond);               \
+        return -1;                                                                      \
+    }                                                                                   \
+} while (0)
+
+static uint64_t state = 0x2545F4914F6CDD1DULL;
+
+static uint64_t rnd() {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+
+    return state;
+}
+
+static double now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static void report(const char *what, double seconds, size_t cnt) {
+    printf("    %-36s %10.1f ns\n", what, seconds * 1e9 / (double) cnt);
+}
+
+static int get_value(void *data, mib_value_t *value) {
+    return mib_value_set_integer(value, (int64_t) (intptr_t) data);
+}
+
+static int make_oid(arena_t *arena, size_t i, oid_t *oid) {
+    uint32_t arcs[19] = { 1, 3, 6, 1 }, hash = (uint32_t) (i * 2654435761u);
+    size_t cnt, k = i / 2, j;
+    uint8_t *data;
+    ssize_t len;
+
+    if (0 == i % 2) {
+        // ifTable: column and row
+        arcs[4] = 2; arcs[5] = 1; arcs[6] = 2; arcs[7] = 2; arcs[8] = 1;
+        arcs[9] = (uint32_t) (1 + k % 22);
+        arcs[10] = (uint32_t) (1 + k / 22);
+        cnt = 11;
+    } else {
+        // enterprise subtree, the last arc tells entries apart
+        arcs[4] = 4; arcs[5] = 1;
+        arcs[6] = (uint32_t) (2021 + k % 50);
+        cnt = 12 + k % 8;
+        for (j = 7; j < cnt - 1; j++, hash = hash * 1103515245u + 12345u) arcs[j] = hash % (j % 3 ? 16 : 1000);
+        arcs[cnt - 1] = (uint32_t) k;
+    }
+
+    if (NULL == (data = arena_alloc(arena, ber_calc_encoded_subids_len(arcs, cnt))) ||
+        (len = ber_encode_subids(arcs, cnt, data)) < 0) {
+        return -1;
+    }
+
+    oid->data = data;
+    oid->len = (size_t) len;
+
+    return 0;
+}
+
+static int compare_oids(const void *a, const void *b) {
+    return oid_compare(a, b);
+}
+
+// the first OID greater than given one, independent of MIB index
+static const oid_t *upper_bound(const oid_t *sorted, size_t cnt, const oid_t *oid) {
+    size_t lo = 0, hi = cnt, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (oid_compare(&sorted[mid], oid) <= 0) lo = mid + 1; else hi = mid;
+    }
+
+    return lo < cnt ? &sorted[lo] : NULL;
+}
+
+// bulk loader must refuse MIB with OID handled twice
+static int check_conflicts() {
+    static const uint8_t data[] = { 0x2B, 0x06, 0x01, 0x04, 0x01, 0x63, 0x00 };
+    mib_entry_t entries[2] = {
+            { .oid = { sizeof(data), data }, .type = OBJECT_TYPE_INTEGER, .get_value = get_value, .origin = "first" },
+            { .oid = { sizeof(data), data }, .type = OBJECT_TYPE_INTEGER, .get_value = get_value, .origin = "second" },
+    };
+
+    CHECK(0 == mib_add_entries(entries, 2));
+    CHECK(-1 == mib_build_index() && EEXIST == errno);
+    printf("conflicting handlers are reported\n");
+    mib_free();
+
+    return 0;
+}
+
+static int bench_mib(size_t n) {
+    mib_entry_t *entries = calloc(n, sizeof(*entries)), tmp;
+    oid_t *sorted = calloc(n, sizeof(*sorted)), oid, walk = { 0 };
+    arena_t oids = { .block_size = 1024 * 1024 }, arena = { 0 };
+    const mib_entry_t *found;
+    const oid_t *expected;
+    uint8_t longer[128], zero = 0;
+    uint32_t arcs[32];
+    double start;
+    size_t i, j, cnt;
+    int rv = -1;
+
+    CHECK(NULL != entries && NULL != sorted);
+
+    for (i = 0; i < n; i++) {
+        CHECK(0 == make_oid(&oids, i, &entries[i].oid));
+        entries[i].type = OBJECT_TYPE_INTEGER;
+        entries[i].get_value = get_value;
+        entries[i].data = (void *) (intptr_t) i;
+        entries[i].speed = MIB_SPEED_FAST;
+    }
+
+    // handlers are registered in no particular order
+    for (i = n - 1; i > 0; i--) {
+        j = rnd() % (i + 1);
+        tmp = entries[i]; entries[i] = entries[j]; entries[j] = tmp;
+    }
+
+    for (i = 0; i < n; i++) sorted[i] = entries[i].oid;
+    qsort(sorted, n, sizeof(*sorted), compare_oids);
+
+    printf("%zu entries:\n", n);
+
+    start = now();
+    CHECK(0 == mib_add_entries(entries, n) && 0 == mib_build_index());
+    printf("    %-36s %10.1f ms\n", "bulk load and index", (now() - start) * 1e3);
+
+    // GET: hashed exact match against ordered search
+    start = now();
+    for (i = 0; i < LOOKUPS; i++) {
+        found = mib_find(&arena, &entries[i % n].oid);
+        CHECK(NULL != found && 0 == oid_compare(&found->oid, &entries[i % n].oid));
+    }
+    report("GET, hash index", now() - start, LOOKUPS);
+
+    start = now();
+    for (i = 0; i < LOOKUPS; i++) {
+        CHECK(NULL != bsearch(&entries[i % n].oid, sorted, n, sizeof(*sorted), compare_oids));
+    }
+    report("GET, binary search over sorted OIDs", now() - start, LOOKUPS);
+
+    // OID followed by one more arc isn't registered
+    for (i = 0; i < n; i++) {
+        memcpy(longer, entries[i].oid.data, entries[i].oid.len);
+        longer[entries[i].oid.len] = 0;
+        oid = (oid_t) { entries[i].oid.len + 1, longer };
+        CHECK(NULL == mib_find(&arena, &oid));
+    }
+
+    // GETNEXT: walk visits every entry once and in order
+    walk = (oid_t) { 1, &zero };
+    start = now();
+    for (cnt = 0; NULL != (found = mib_findnext(&arena, &walk)); cnt++) {
+        CHECK(cnt < n && 0 == oid_compare(&found->oid, &sorted[cnt]));
+        walk = found->oid;
+    }
+    report("GETNEXT walk step", now() - start, n);
+    CHECK(cnt == n);
+
+    // GETNEXT from registered OIDs, OIDs between siblings and random ones is their lexicographic successor
+    start = now();
+    for (i = 0; i < LOOKUPS; i++) {
+        oid = entries[i % n].oid;
+
+        if (1 == i % 3) {
+            memcpy(longer, oid.data, oid.len);
+            longer[oid.len] = (uint8_t) (rnd() % 0x80);
+            oid = (oid_t) { oid.len + 1, longer };
+        } else if (2 == i % 3) {
+            for (j = 0; j < 12; j++) arcs[j] = (uint32_t) (rnd() % 8);
+            arcs[0] = 1;
+            arcs[1] = 3;
+            oid = (oid_t) { (size_t) ber_encode_subids(arcs, 12, longer), longer };
+        }
+
+        found = mib_findnext(&arena, &oid);
+        expected = upper_bound(sorted, n, &oid);
+        CHECK((NULL == found) == (NULL == expected));
+        CHECK(NULL == found || 0 == oid_compare(&found->oid, expected));
+    }
+    report("GETNEXT lookup and check", now() - start, LOOKUPS);
+
+    // codecs: validation, decoding to arcs and encoding back give the same octets
+    start = now();
+    for (i = 0; i < LOOKUPS; i++) {
+        CHECK(ber_decode_oid(sorted[i % n].data, sorted[i % n].len, &oid) == (ssize_t) sorted[i % n].len);
+    }
+    report("OID validation", now() - start, LOOKUPS);
+
+    start = now();
+    for (i = 0; i < LOOKUPS; i++) {
+        cnt = ber_decode_arcs(sorted[i % n].data, sorted[i % n].len, arcs, 32);
+        CHECK(cnt <= 32 && ber_encode_arcs(arcs, cnt, longer) == (ssize_t) sorted[i % n].len);
+        CHECK(0 == memcmp(longer, sorted[i % n].data, sorted[i % n].len));
+    }
+    report("OID decode and encode back", now() - start, LOOKUPS);
+
+    rv = 0;
+
+    mib_free();
+    arena_free(&arena);
+    arena_free(&oids);
+    free(sorted);
+    free(entries);
+
+    return rv;
+}
+
+static int write_file(const char *path, const char *content, mode_t mode) {
+    FILE *f = fopen(path, "w");
+
+    CHECK(NULL != f);
+    fputs(content, f);
+    CHECK(0 == fclose(f) && 0 == chmod(path, mode));
+
+    return 0;
+}
+
+static int bench_handler(const char *name, const char *oid_str, size_t calls) {
+    arena_t arena = { 0 };
+    const mib_entry_t *entry;
+    size_t val_size, i;
+    void *val;
+    double start;
+    int decoded;
+    oid_t oid;
+
+    CHECK(0 == string_to_oid(&arena, oid_str, &oid) && NULL != (entry = mib_find(&arena, &oid)));
+
+    start = now();
+    for (i = 0; i < calls; i++) {
+        CHECK(ERROR_STATUS_NO_ERROR == mib_get_encoded(&arena, entry, &val, &val_size));
+        CHECK(ber_decode_integer(val, val_size, &decoded) > 0 && 42 == decoded);
+        arena_reset(&arena);
+    }
+    report(name, now() - start, calls);
+
+    arena_free(&arena);
+
+    return 0;
+}
+
+// script handlers are compared by cost of single get
+static int bench_handlers() {
+    char dir[] = "/tmp/snmp-bench-XXXXXX", path[64];
+    int rv = -1;
+
+    CHECK(NULL != mkdtemp(dir));
+
+    snprintf(path, sizeof(path), "%s/value.sh", dir);
+    if (0 != write_file(path, "#!/bin/sh\n"
+                              "case \"$1\" in\n"
+                              "  oid) echo 1.3.6.1.4.1.99.1.0;;\n"
+                              "  type) echo INTEGER;;\n"
+                              "  serve) while read -r m o v; do echo \"0 42\"; done;;\n"
+                              "esac\n", 0755)) goto end;
+
+#ifdef SNMP_WITH_LUA
+    snprintf(path, sizeof(path), "%s/value.lua", dir);
+    if (0 != write_file(path, "return { oid = \"1.3.6.1.4.1.99.2.0\", type = \"INTEGER\",\n"
+                              "         get = function() return 42 end }\n", 0644)) goto end;
+#endif
+
+    if (1 != scripts_load(dir, NULL)) goto end;
+#ifdef SNMP_WITH_LUA
+    if (1 != lua_handlers_load(dir) || 0 != lua_handlers_attach()) goto end;
+#endif
+    if (0 != mib_build_index()) goto end;
+
+    printf("handlers:\n");
+    if (0 != bench_handler("shell script get", "1.3.6.1.4.1.99.1.0", SHELL_CALLS)) goto end;
+#ifdef SNMP_WITH_LUA
+    if (0 != bench_handler("Lua get", "1.3.6.1.4.1.99.2.0", LUA_CALLS)) goto end;
+#endif
+
+    rv = 0;
+
+    end:
+    scripts_free();
+#ifdef SNMP_WITH_LUA
+    lua_handlers_detach();
+    lua_handlers_free();
+    snprintf(path, sizeof(path), "%s/value.lua", dir);
+    unlink(path);
+#endif
+    mib_free();
+    snprintf(path, sizeof(path), "%s/value.sh", dir);
+    unlink(path);
+    rmdir(dir);
+
+    return rv;
+}
+
+int main(int argc, char *argv[]) {
+    size_t n;
+    int i;
+
+    if (0 != check_conflicts()) return EXIT_FAILURE;
+
+    for (i = 1; i < argc || 1 == i; i++) {
+        n = i < argc ? strtoul(argv[i], NULL, 10) : DEFAULT_ENTRIES;
+        if (0 == n || 0 != bench_mib(n)) return EXIT_FAILURE;
+    }
+
+    return 0 == bench_handlers() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,194 @@
+/*
+ * load.c
+ * Copyright (c) 2020 Sergei Kosivchenko <archichief@gmail.com>
+ *
+ * smart-snmp is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * smart-snmp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/*
+ * Load generator for running agent, used to compare transports (recvfrom() loop, --batch-size and io_uring build):
+ *     load PORT SECONDS THREADS WINDOW
+ * Every thread keeps WINDOW GetRequests for sysDescr.0 in flight, window lost to drops is sent again after 100 ms.
+ * It isn't run by ctest, since agent must be started first.
+ */
+
+#define LOAD_BATCH 64
+
+// SNMPv2c GetRequest for 1.3.6.1.2.1.1.1.0, community "public"
+static const uint8_t request[] = {
+        0x30, 0x26, 0x02, 0x01, 0x01, 0x04, 0x06, 0x70, 0x75, 0x62, 0x6C, 0x69, 0x63, 0xA0, 0x19, 0x02, 0x01, 0x01,
+        0x02, 0x01, 0x00, 0x02, 0x01, 0x00, 0x30, 0x0E, 0x30, 0x0C, 0x06, 0x08, 0x2B, 0x06, 0x01, 0x02, 0x01, 0x01,
+        0x01, 0x00, 0x05, 0x00
+};
+
+typedef struct load_thread {
+    pthread_t thread;
+    unsigned short port;
+    size_t window;
+    double until;
+    unsigned long long responses;
+    unsigned long long resent;
+    int err;
+} load_thread_t;
+
+static double now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+// sends cnt copies of request, window is refilled by as few system calls as possible
+static int send_requests(int sockfd, size_t cnt) {
+    struct mmsghdr msgs[LOAD_BATCH];
+    struct iovec iov = { .iov_base = (void *) request, .iov_len = sizeof(request) };
+    size_t i, n;
+    int rv;
+
+    while (cnt) {
+        n = cnt < LOAD_BATCH ? cnt : LOAD_BATCH;
+
+        for (i = 0; i < n; i++) {
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_iov = &iov;
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        if ((rv = sendmmsg(sockfd, msgs, n, 0)) < 1) return -1;
+        cnt -= (size_t) rv;
+    }
+
+    return 0;
+}
+
+static void *load_routine(void *arg) {
+    load_thread_t *t = arg;
+    struct sockaddr_in sin = { .sin_family = AF_INET, .sin_port = htons(t->port) };
+    struct timeval timeout = { .tv_usec = 100000 };
+    uint8_t buffers[LOAD_BATCH][512];
+    struct mmsghdr msgs[LOAD_BATCH];
+    struct iovec iovs[LOAD_BATCH];
+    int sockfd, i, rv;
+
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (-1 == (sockfd = socket(AF_INET, SOCK_DGRAM, 0)) ||
+        0 != setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) ||
+        0 != connect(sockfd, (struct sockaddr *) &sin, sizeof(sin)) ||
+        0 != send_requests(sockfd, t->window)) {
+        t->err = errno;
+        goto end;
+    }
+
+    while (now() < t->until) {
+        for (i = 0; i < LOAD_BATCH; i++) {
+            iovs[i].iov_base = buffers[i];
+            iovs[i].iov_len = sizeof(buffers[i]);
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        // the first response is waited for, others are taken if they are already here
+        if ((rv = recvmmsg(sockfd, msgs, LOAD_BATCH, MSG_WAITFORONE, NULL)) < 1) {
+            if (EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno) {
+                t->err = errno;
+                break;
+            }
+
+            // whole window was dropped
+            if (EINTR != errno && 0 != send_requests(sockfd, t->window)) break;
+            t->resent += t->window;
+            continue;
+        }
+
+        t->responses += (unsigned long long) rv;
+        if (0 != send_requests(sockfd, (size_t) rv)) {
+            t->err = errno;
+            break;
+        }
+    }
+
+    end:
+    if (-1 != sockfd) close(sockfd);
+
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long long responses = 0, resent = 0;
+    load_thread_t *threads;
+    size_t threads_cnt, i;
+    double seconds, start;
+
+    if (argc != 5) {
+        fprintf(stderr, "Usage: %s PORT SECONDS THREADS WINDOW\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    seconds = atof(argv[2]);
+    threads_cnt = strtoul(argv[3], NULL, 10);
+
+    if (seconds <= 0 || 0 == threads_cnt || NULL == (threads = calloc(threads_cnt, sizeof(*threads)))) {
+        fprintf(stderr, "Usage: %s PORT SECONDS THREADS WINDOW\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    start = now();
+
+    for (i = 0; i < threads_cnt; i++) {
+        threads[i].port = (unsigned short) atoi(argv[1]);
+        threads[i].window = strtoul(argv[4], NULL, 10);
+        threads[i].until = start + seconds;
+
+        if (0 != pthread_create(&threads[i].thread, NULL, load_routine, &threads[i])) {
+            fprintf(stderr, "Can't start load thread\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (i = 0; i < threads_cnt; i++) {
+        pthread_join(threads[i].thread, NULL);
+
+        if (threads[i].err) {
+            fprintf(stderr, "Load thread failed: %s\n", strerror(threads[i].err));
+            return EXIT_FAILURE;
+        }
+
+        responses += threads[i].responses;
+        resent += threads[i].resent;
+    }
+
+    printf("responses: %llu, per second: %.0f, resent after drops: %llu\n", responses,
+           (double) responses / (now() - start), resent);
+
+    free(threads);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,246 @@
+/*
+ * test_ber.c
+ * Copyright (c) 2020 Sergei Kosivchenko <archichief@gmail.com>
+ *
+ * smart-snmp is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * smart-snmp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+
+#include "ber.h"
+
+/*
+ * Round-trip properties of OID and INTEGER codecs checked on random values: everything encoded is decoded back,
+ * calculated lengths match encoded ones and are minimal, and OID validation agrees with plain octet by octet rules.
+ * Seed can be given as the first argument to reproduce failure. Malformed packets what broke decoders are kept as
+ * regression cases.
+ */
+
+#define ITERATIONS 200000
+#define ARCS_MAX 40
+
+#define CHECK(cond) do {                                                                \
+    if (!(cond)) {                                                                      \
+        fprintf(stderr, "%s:%d: %s failed, seed %llu, iteration %zu\n", __FILE__,       \
+                __LINE__, #cond, seed, iteration);                                      \
+        return 1;                                                                       \
+    }                                                                                   \
+} while (0)
+
+static unsigned long long seed = 0x2545F4914F6CDD1DULL;
+static size_t iteration;
+static uint64_t state;
+
+static uint64_t rnd() {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+
+    return state;
+}
+
+// short arcs are the common case and go through word at a time path, long ones are spread over all bit widths
+static uint32_t rnd_arc() {
+    unsigned int bits = rnd() % 2 ? (unsigned int) (rnd() % 8) : (unsigned int) (rnd() % 33);
+
+    if (0 == bits) return 0;
+
+    return (uint32_t) ((rnd() & ((1ULL << (bits - 1)) - 1)) | (1ULL << (bits - 1)));
+}
+
+// arcs of minimal length which fit into 32 bits, the last octet ends an arc
+static bool is_valid_oid(const uint8_t *data, size_t size) {
+    size_t i = 0, n;
+
+    if (0 == size || (data[size - 1] & 0x80)) return false;
+
+    while (i < size) {
+        for (n = 1; data[i + n - 1] & 0x80; n++);
+
+        if (0x80 == data[i] || n > 5 || (5 == n && (data[i] & 0x7F) > 0x0F)) return false;
+        i += n;
+    }
+
+    return true;
+}
+
+static int check_oids() {
+    uint32_t arcs[ARCS_MAX], decoded[ARCS_MAX + 1], subid;
+    uint8_t buf[ARCS_MAX * 5];
+    size_t cnt, len, max, i;
+    ssize_t encoded;
+    oid_t oid;
+
+    for (iteration = 0; iteration < ITERATIONS; iteration++) {
+        cnt = 2 + rnd() % (ARCS_MAX - 1);
+        arcs[0] = (uint32_t) (rnd() % 3);
+        arcs[1] = arcs[0] < 2 ? (uint32_t) (rnd() % 40) : rnd_arc() % (UINT32_MAX - 80);
+        for (i = 2; i < cnt; i++) arcs[i] = rnd_arc();
+
+        len = ber_calc_encoded_subids_len(arcs, cnt);
+        encoded = ber_encode_subids(arcs, cnt, buf);
+
+        CHECK(encoded > 0 && (size_t) encoded == len);
+        CHECK(is_valid_oid(buf, len));
+        CHECK(ber_decode_oid(buf, len, &oid) == (ssize_t) len && oid.data == buf && oid.len == len);
+
+        // the first two arcs share one subidentifier
+        CHECK(ber_decode_arcs(buf, len, decoded, ARCS_MAX) == cnt - 1);
+        CHECK(decoded[0] == arcs[0] * 40 + arcs[1]);
+        for (i = 2; i < cnt; i++) CHECK(decoded[i - 1] == arcs[i]);
+
+        // arcs beyond limit are counted but not written
+        max = rnd() % cnt;
+        decoded[max] = UINT32_MAX;
+        CHECK(ber_decode_arcs(buf, len, decoded, max) == cnt - 1);
+        CHECK(UINT32_MAX == decoded[max]);
+
+        subid = arcs[0] * 40 + arcs[1];
+        CHECK(ber_calc_encoded_arcs_len(&subid, 1) + ber_calc_encoded_arcs_len(arcs + 2, cnt - 2) == len);
+    }
+
+    return 0;
+}
+
+// damaged encodings are rejected exactly when octet by octet rules reject them
+static int check_oid_validation() {
+    static const uint8_t octets[] = { 0x00, 0x01, 0x0F, 0x10, 0x7F, 0x80, 0x81, 0x8F, 0x90, 0xFF };
+    uint8_t buf[24];
+    size_t size, i;
+    oid_t oid;
+
+    for (iteration = 0; iteration < ITERATIONS; iteration++) {
+        size = 1 + rnd() % sizeof(buf);
+
+        for (i = 0; i < size; i++) {
+            buf[i] = rnd() % 4 ? octets[rnd() % sizeof(octets)] : (uint8_t) rnd();
+        }
+
+        CHECK(is_valid_oid(buf, size) == (ber_decode_oid(buf, size, &oid) == (ssize_t) size));
+    }
+
+    return 0;
+}
+
+// the shortest two's complement encoding
+static size_t int64_len(int64_t val) {
+    size_t len = 1;
+
+    while (len < 8 && (val < -(INT64_C(1) << (8 * len - 1)) || val > (INT64_C(1) << (8 * len - 1)) - 1)) len++;
+
+    return len;
+}
+
+static int64_t decode_int64(const uint8_t *data, size_t len) {
+    uint64_t val = (data[0] & 0x80) ? UINT64_MAX : 0;
+    size_t i;
+
+    for (i = 0; i < len; i++) val = (val << 8) | data[i];
+
+    return (int64_t) val;
+}
+
+static int64_t rnd_int64() {
+    unsigned int bits = (unsigned int) (rnd() % 65);
+    uint64_t val = bits ? rnd() >> (64 - bits) : 0;
+
+    return rnd() % 2 ? (int64_t) ~val : (int64_t) val;
+}
+
+static int check_integers() {
+    static const int64_t edges[] = {
+            0, 1, -1, 127, 128, -128, -129, 255, 256, 32767, 32768, -32768, -32769, 8388607, 8388608, -8388608,
+            -8388609, INT_MAX, INT_MIN, (int64_t) INT_MAX + 1, (int64_t) INT_MIN - 1, INT64_MAX, INT64_MIN,
+    };
+    uint8_t buf[9];
+    int64_t val64;
+    uint64_t uval;
+    size_t len;
+    int val, decoded;
+
+    for (iteration = 0; iteration < ITERATIONS + sizeof(edges) / sizeof(*edges); iteration++) {
+        val64 = iteration < sizeof(edges) / sizeof(*edges) ? edges[iteration] : rnd_int64();
+
+        len = ber_calc_encoded_int64_len(&val64);
+        CHECK(len == int64_len(val64));
+        CHECK(ber_encode_int64(&val64, buf) == (ssize_t) len);
+        CHECK(decode_int64(buf, len) == val64);
+
+        // unsigned value keeps its high bit only behind leading zero
+        uval = (uint64_t) val64;
+        len = ber_calc_encoded_uint64_len(&uval);
+        CHECK(len == (uval > INT64_MAX ? 9 : int64_len((int64_t) uval)));
+        CHECK(ber_encode_uint64(&uval, buf) == (ssize_t) len);
+        CHECK(9 != len || 0 == buf[0]);
+        CHECK((uint64_t) decode_int64(buf + (9 == len), len - (9 == len)) == uval);
+        CHECK(9 == len || 0 == (buf[0] & 0x80));
+
+        if (val64 < INT_MIN || val64 > INT_MAX) continue;
+
+        val = (int) val64;
+        len = ber_calc_encoded_integer_len(&val);
+        CHECK(len == int64_len(val64));
+        CHECK(ber_encode_integer(&val, buf) == (ssize_t) len);
+        CHECK(ber_decode_integer(buf, len, &decoded) == (ssize_t) len && decoded == val);
+    }
+
+    return 0;
+}
+
+// packets tree decoder must reject without reading past their end, every one is copied to buffer of its exact size
+static int check_malformed_packets() {
+    static const struct {
+        size_t size;
+        uint8_t data[16];
+    } packets[] = {
+            { 1, { 0x30 } },                                                // no length
+            { 3, { 0x30, 0x84, 0x00 } },                                    // truncated length octets
+            { 12, { 0x30, 0x88, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFD, 0x04, 0x00 } },   // size wraps around
+    };
+    asn1_node_t root;
+    arena_t arena = { 0 };
+    uint8_t *data;
+    ssize_t rv;
+
+    for (iteration = 0; iteration < sizeof(packets) / sizeof(*packets); iteration++) {
+        if (NULL == (data = malloc(packets[iteration].size))) return 1;
+
+        memcpy(data, packets[iteration].data, packets[iteration].size);
+        rv = ber_decode_asn1_tree(&arena, data, packets[iteration].size, &root);
+        free(data);
+        arena_reset(&arena);
+
+        CHECK(-1 == rv);
+    }
+
+    arena_free(&arena);
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) seed = strtoull(argv[1], NULL, 0);
+    state = seed ? seed : 1;
+
+    if (0 != check_oids() || 0 != check_oid_validation() || 0 != check_integers() ||
+        0 != check_malformed_packets()) return EXIT_FAILURE;
+
+    printf("BER round trips hold for seed %llu\n", seed);
+
+    return EXIT_SUCCESS;
+}
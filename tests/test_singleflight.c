@@ -0,0 +1,93 @@
+/*
+ * test_singleflight.c
+ * Copyright (c) 2020 Sergei Kosivchenko <archichief@gmail.com>
+ *
+ * smart-snmp is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * smart-snmp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "singleflight.h"
+
+/*
+ * Thundering herd: N threads ask for the same entry at once, getter is called once and all of them receive its
+ * value. Getter doesn't return until every thread has asked, so nobody comes after the flight is over.
+ */
+
+#define THREADS 32
+#define VALUE 4242
+
+static atomic_int calls;
+static atomic_int asking;
+
+static int slow_get(__attribute__((unused)) void *data, mib_value_t *value) {
+    atomic_fetch_add(&calls, 1);
+
+    while (atomic_load(&asking) < THREADS) usleep(1000);
+
+    // threads which have just asked reach the flight
+    usleep(100000);
+
+    return mib_value_set_integer(value, VALUE);
+}
+
+static const uint8_t oid_data[] = { 0x2B, 0x06, 0x01, 0x04, 0x01, 0x63, 0x01, 0x00 };
+
+static const mib_entry_t entry = {
+        .oid = { sizeof(oid_data), oid_data },
+        .type = OBJECT_TYPE_INTEGER,
+        .get_value = slow_get,
+        .speed = MIB_SPEED_FAST,
+};
+
+static void *ask(void *arg) {
+    arena_t arena = { 0 };
+    size_t val_size;
+    void *val;
+    int decoded = 0;
+
+    atomic_fetch_add(&asking, 1);
+
+    *(int *) arg = ERROR_STATUS_NO_ERROR == singleflight_get_encoded(&arena, &entry, &val, &val_size) &&
+                   ber_decode_integer(val, val_size, &decoded) > 0 && VALUE == decoded;
+
+    arena_free(&arena);
+
+    return NULL;
+}
+
+int main() {
+    pthread_t threads[THREADS];
+    int results[THREADS], i, served = 0;
+
+    for (i = 0; i < THREADS; i++) {
+        if (0 != pthread_create(&threads[i], NULL, ask, &results[i])) {
+            fprintf(stderr, "Can't start thread\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        served += results[i];
+    }
+
+    printf("%d concurrent callers, getter calls: %d, served: %d\n", THREADS, atomic_load(&calls), served);
+
+    return 1 == atomic_load(&calls) && THREADS == served ? EXIT_SUCCESS : EXIT_FAILURE;
+}
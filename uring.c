@@ -0,0 +1,365 @@
+/*
+ * uring.c
+ * Copyright (c) 2020 Sergei Kosivchenko <archichief@gmail.com>
+ *
+ * smart-snmp is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * smart-snmp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <memory.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "uring.h"
+#include "processor.h"
+
+#define URING_BUFFER_GROUP 0
+#define URING_RECV_TAG UINT64_MAX
+
+// provided buffer holds recvmsg header, sender address and datagram itself
+#define URING_BUFFER_SIZE (sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_storage) + BUFSIZ)
+
+#define load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+// response waiting for sendmsg completion
+typedef struct uring_send_slot {
+    struct msghdr msg;
+    struct iovec iov;
+    struct sockaddr_storage addr;
+    uint8_t response[SNMP_MAX_DATAGRAM_SIZE];
+} uring_send_slot_t;
+
+struct uring_transport {
+    int ring_fd;
+    int sockfd;
+
+    void *ring;                                 // SQ and CQ rings share single mapping
+    size_t ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned int sq_entries;
+    unsigned int to_submit;                     // SQEs queued since last io_uring_enter()
+
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_size;
+    uint16_t buf_tail;
+    uint8_t *buffers;
+
+    struct msghdr recv_msg;                     // template for multishot recvmsg
+    bool recv_armed;
+
+    uring_send_slot_t *slots;
+    unsigned int free_slots[SNMP_URING_DEPTH];
+    unsigned int free_slots_cnt;
+    uint8_t scratch[SNMP_MAX_DATAGRAM_SIZE];    // used for synchronous send when all slots are busy
+
+    uring_request_handler_t handler;
+    void *user_data;
+};
+
+static inline int uring_setup(unsigned int entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static inline int uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static inline int uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static int submit(uring_transport_t *t) {
+    int rv;
+
+    while (t->to_submit) {
+        if ((rv = uring_enter(t->ring_fd, t->to_submit, 0, 0)) < 0) {
+            if (EINTR == errno) continue;
+            return -1;
+        }
+
+        t->to_submit -= (unsigned int)rv;
+    }
+
+    return 0;
+}
+
+static struct io_uring_sqe *get_sqe(uring_transport_t *t) {
+    unsigned int tail = *t->sq_tail, idx;
+    struct io_uring_sqe *sqe;
+
+    // SQ is full, let kernel consume it first
+    if (tail - load_acquire(t->sq_head) >= t->sq_entries && 0 != submit(t)) return NULL;
+
+    idx = tail & *t->sq_mask;
+    sqe = &t->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+
+    t->sq_array[idx] = idx;
+    store_release(t->sq_tail, tail + 1);
+    t->to_submit++;
+
+    return sqe;
+}
+
+static void provide_buffer(uring_transport_t *t, uint16_t bid) {
+    struct io_uring_buf *buf = &t->buf_ring->bufs[t->buf_tail & (SNMP_URING_DEPTH - 1)];
+
+    buf->addr = (uint64_t)(uintptr_t)(t->buffers + (size_t)bid * URING_BUFFER_SIZE);
+    buf->len = URING_BUFFER_SIZE;
+    buf->bid = bid;
+
+    store_release(&t->buf_ring->tail, ++t->buf_tail);
+}
+
+static int arm_recv(uring_transport_t *t) {
+    struct io_uring_sqe *sqe;
+
+    if (NULL == (sqe = get_sqe(t))) return -1;
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = t->sockfd;
+    sqe->addr = (uint64_t)(uintptr_t)&t->recv_msg;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = URING_RECV_TAG;
+
+    t->recv_armed = true;
+
+    return 0;
+}
+
+static void handle_datagram(uring_transport_t *t, const uint8_t *buf, size_t size) {
+    const struct io_uring_recvmsg_out *out = (const struct io_uring_recvmsg_out *)buf;
+    const uint8_t *name = buf + sizeof(*out), *payload;
+    size_t header_size = sizeof(*out) + t->recv_msg.msg_namelen + t->recv_msg.msg_controllen;
+    socklen_t namelen;
+    struct io_uring_sqe *sqe;
+    uring_send_slot_t *slot;
+    uint8_t *resp, *resp_buffer;
+    ssize_t resp_size;
+    unsigned int slot_idx = 0;
+
+    if (size < header_size || size - header_size < out->payloadlen || (out->flags & MSG_TRUNC)) return;
+
+    payload = buf + header_size;
+    namelen = out->namelen < t->recv_msg.msg_namelen ? out->namelen : t->recv_msg.msg_namelen;
+
+    // all slots wait for completion, response is sent synchronously
+    if (t->free_slots_cnt) {
+        slot_idx = t->free_slots[--t->free_slots_cnt];
+        resp_buffer = t->slots[slot_idx].response;
+    } else {
+        resp_buffer = t->scratch;
+    }
+
+    if ((resp_size = t->handler(t->user_data, (const struct sockaddr *)name, namelen, payload, out->payloadlen,
+                                resp_buffer, SNMP_MAX_DATAGRAM_SIZE, &resp)) < 0) {
+        if (resp_buffer != t->scratch) t->free_slots[t->free_slots_cnt++] = slot_idx;
+        return;
+    }
+
+    if (resp_buffer == t->scratch) {
+        sendto(t->sockfd, resp, resp_size, MSG_DONTWAIT, (const struct sockaddr *)name, namelen);
+        return;
+    }
+
+    slot = &t->slots[slot_idx];
+    memmove(&slot->addr, name, namelen);
+    slot->iov.iov_base = resp;
+    slot->iov.iov_len = resp_size;
+    memset(&slot->msg, 0, sizeof(slot->msg));
+    slot->msg.msg_name = &slot->addr;
+    slot->msg.msg_namelen = namelen;
+    slot->msg.msg_iov = &slot->iov;
+    slot->msg.msg_iovlen = 1;
+
+    if (NULL == (sqe = get_sqe(t))) {
+        t->free_slots[t->free_slots_cnt++] = slot_idx;
+        return;
+    }
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = t->sockfd;
+    sqe->addr = (uint64_t)(uintptr_t)&slot->msg;
+    sqe->len = 1;
+    sqe->user_data = slot_idx;
+}
+
+int uring_transport_process(uring_transport_t *t, size_t *sent) {
+    unsigned int head, tail;
+    struct io_uring_cqe *cqe;
+    uint16_t bid;
+    int received = 0;
+
+    *sent = 0;
+
+    for (;;) {
+        head = *t->cq_head;
+        if (head == (tail = load_acquire(t->cq_tail))) break;
+
+        for (; head != tail; head++) {
+            cqe = &t->cqes[head & *t->cq_mask];
+
+            if (URING_RECV_TAG == cqe->user_data) {
+                // multishot receive was terminated, for example because all buffers were taken
+                if (!(cqe->flags & IORING_CQE_F_MORE)) t->recv_armed = false;
+
+                if (cqe->flags & IORING_CQE_F_BUFFER) {
+                    bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+
+                    if (cqe->res > 0) {
+                        handle_datagram(t, t->buffers + (size_t)bid * URING_BUFFER_SIZE, (size_t)cqe->res);
+                        received++;
+                    }
+
+                    provide_buffer(t, bid);
+                }
+            } else {
+                if (cqe->res >= 0) (*sent)++;
+
+                t->free_slots[t->free_slots_cnt++] = (unsigned int)cqe->user_data;
+            }
+        }
+
+        store_release(t->cq_head, head);
+    }
+
+    if (!t->recv_armed && 0 != arm_recv(t)) return -1;
+
+    // responses and re-armed receive are submitted all at once
+    if (0 != submit(t)) return -1;
+
+    return received;
+}
+
+int uring_transport_fd(const uring_transport_t *transport) {
+    return transport->ring_fd;
+}
+
+uring_transport_t *uring_transport_create(int sockfd, uring_request_handler_t handler, void *user_data) {
+    struct io_uring_params params;
+    struct io_uring_buf_reg reg;
+    uring_transport_t *t;
+    size_t sq_size, cq_size;
+    unsigned int i;
+
+    if (NULL == (t = calloc(1, sizeof(*t)))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    t->ring_fd = -1;
+    t->sockfd = sockfd;
+    t->handler = handler;
+    t->user_data = user_data;
+    t->ring = MAP_FAILED;
+    t->sqes = MAP_FAILED;
+    t->buf_ring = MAP_FAILED;
+
+    // single issuer appeared together with multishot receive in Linux 6.0, so it is also used as feature probe
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SINGLE_ISSUER;
+
+    if ((t->ring_fd = uring_setup(SNMP_URING_DEPTH * 2, &params)) < 0) goto unsupported;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) goto unsupported;
+
+    sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    t->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    t->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    t->ring = mmap(NULL, t->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, t->ring_fd,
+                   IORING_OFF_SQ_RING);
+    t->sqes = mmap(NULL, t->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, t->ring_fd,
+                   IORING_OFF_SQES);
+    if (MAP_FAILED == t->ring || MAP_FAILED == t->sqes) goto fail;
+
+    t->sq_head = (unsigned int *)((uint8_t *)t->ring + params.sq_off.head);
+    t->sq_tail = (unsigned int *)((uint8_t *)t->ring + params.sq_off.tail);
+    t->sq_mask = (unsigned int *)((uint8_t *)t->ring + params.sq_off.ring_mask);
+    t->sq_array = (unsigned int *)((uint8_t *)t->ring + params.sq_off.array);
+    t->sq_entries = params.sq_entries;
+
+    t->cq_head = (unsigned int *)((uint8_t *)t->ring + params.cq_off.head);
+    t->cq_tail = (unsigned int *)((uint8_t *)t->ring + params.cq_off.tail);
+    t->cq_mask = (unsigned int *)((uint8_t *)t->ring + params.cq_off.ring_mask);
+    t->cqes = (struct io_uring_cqe *)((uint8_t *)t->ring + params.cq_off.cqes);
+
+    // buffer ring must be page aligned, anonymous mapping guarantees it
+    t->buf_ring_size = SNMP_URING_DEPTH * sizeof(struct io_uring_buf);
+    t->buf_ring = mmap(NULL, t->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    t->buffers = malloc((size_t)SNMP_URING_DEPTH * URING_BUFFER_SIZE);
+    t->slots = malloc(SNMP_URING_DEPTH * sizeof(*t->slots));
+    if (MAP_FAILED == t->buf_ring || NULL == t->buffers || NULL == t->slots) {
+        errno = ENOMEM;
+        goto fail;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)t->buf_ring;
+    reg.ring_entries = SNMP_URING_DEPTH;
+    reg.bgid = URING_BUFFER_GROUP;
+
+    if (uring_register(t->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) goto unsupported;
+
+    for (i = 0; i < SNMP_URING_DEPTH; i++) {
+        provide_buffer(t, (uint16_t)i);
+        t->free_slots[t->free_slots_cnt++] = i;
+    }
+
+    t->recv_msg.msg_namelen = sizeof(struct sockaddr_storage);
+
+    if (0 != arm_recv(t) || 0 != submit(t)) goto fail;
+
+    return t;
+
+    unsupported:
+    // EINVAL and ENOSYS mean old kernel, EPERM means io_uring is disabled by administrator
+    if (EINVAL == errno || ENOSYS == errno || EPERM == errno) errno = ENOTSUP;
+
+    fail:
+    uring_transport_free(t);
+    return NULL;
+}
+
+void uring_transport_free(uring_transport_t *t) {
+    int err = errno;
+
+    if (NULL == t) return;
+
+    // closing ring cancels all requests, so buffers can be released after it
+    if (t->ring_fd >= 0) close(t->ring_fd);
+    if (MAP_FAILED != t->ring) munmap(t->ring, t->ring_size);
+    if (MAP_FAILED != t->sqes) munmap(t->sqes, t->sqes_size);
+    if (MAP_FAILED != t->buf_ring) munmap(t->buf_ring, t->buf_ring_size);
+
+    free(t->buffers);
+    free(t->slots);
+    free(t);
+
+    errno = err;
+}
@@ -0,0 +1,59 @@
+/*
+ * uring.h
+ * Copyright (c) 2020 Sergei Kosivchenko <archichief@gmail.com>
+ *
+ * smart-snmp is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * smart-snmp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SNMP_URING_H
+#define SNMP_URING_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#ifndef SNMP_URING_DEPTH
+#define SNMP_URING_DEPTH 64
+#endif
+
+typedef struct uring_transport uring_transport_t;
+
+/*
+ * Prepares response for request received from addr, same contract as process_request(). Handler which defers
+ * response, e.g. parks request, returns -1 and sends it to addr later by itself.
+ */
+typedef ssize_t (*uring_request_handler_t)(void *user_data, const struct sockaddr *addr, socklen_t addrlen,
+                                           const uint8_t *req, size_t req_size, uint8_t *resp_buffer,
+                                           size_t resp_buffer_size, uint8_t **resp);
+
+/*
+ * io_uring transport for UDP socket. Datagrams are received by single multishot recvmsg into ring of provided buffers
+ * and responses are sent by sendmsg requests submitted together with one io_uring_enter() call.
+ *
+ * Transport must be created and used by the same thread. If kernel doesn't support required features (multishot
+ * receive and provided buffer rings, Linux 6.0+) NULL is returned and errno is set, so caller can fall back to
+ * recvfrom()/sendto() loop.
+ */
+uring_transport_t *uring_transport_create(int sockfd, uring_request_handler_t handler, void *user_data);
+
+// descriptor becomes readable when completions are available, suitable for event loop
+int uring_transport_fd(const uring_transport_t *transport);
+
+// reaps all completions, handles received requests and submits responses, returns number of received datagrams
+int uring_transport_process(uring_transport_t *transport, size_t *sent);
+
+void uring_transport_free(uring_transport_t *transport);
+
+#endif //SNMP_URING_H
@@ -41,6 +41,8 @@ static const char *type_to_string(int type) {
             return "GET RESPONSE";
         case REQUEST_TYPE_GETNEXT:
             return "GETNEXT REQUEST";
+        case REQUEST_TYPE_GETBULK:
+            return "GETBULK REQUEST";
         case REQUEST_TYPE_SET:
             return "SET REQUEST";
         default:
@@ -94,7 +96,7 @@ void print_asn1_tree(const asn1_node_t *root, size_t spaces, const char *prefix)
     free(val);
 
     if (ber_is_constructed_type(root->type)) {
-        char pref[10];
+        char pref[24];
 
         for (i = 0; i < root->content.c.items_num; i++) {
             sprintf(pref, "[%zu] ", i);
@@ -103,32 +105,99 @@ void print_asn1_tree(const asn1_node_t *root, size_t spaces, const char *prefix)
     }
 }
 
-void string_to_oid(const char *val, oid_t *res) {
+int string_to_oid(arena_t *arena, const char *val, oid_t *res) {
+    const char *tmp_val;
     char *end;
-    int32_t subid = 1;
-
-    memset(res, 0, sizeof(*res));
+    size_t subids_cnt = 1, i = 0;
+    uint32_t *subids;
+    unsigned long subid;
+    uint8_t *data;
+    ssize_t len;
 
     // OIDs can start with '.'
     if ('.' == *val) {
         val++;
     }
 
-    while (1) {
-        if ((subid = (int32_t )strtol(val, &end, 10)) == 0) break;
+    for (tmp_val = val; *tmp_val; tmp_val++) {
+        if ('.' == *tmp_val) subids_cnt++;
+    }
+
+    if (NULL == (subids = arena_alloc(arena, subids_cnt * sizeof(*subids)))) return -1;
+
+    while (i < subids_cnt) {
+        errno = 0;
+        subid = strtoul(val, &end, 10);
+
+        if (end == val || '-' == *val || errno || subid > UINT32_MAX || (*end && '.' != *end)) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        subids[i++] = (uint32_t) subid;
         val = end + 1;
-        res->subids[res->subids_cnt++] = subid;
     }
+
+    len = (ssize_t) ber_calc_encoded_subids_len(subids, subids_cnt);
+    if (NULL == (data = arena_alloc(arena, (size_t) len)) || (len = ber_encode_subids(subids, subids_cnt, data)) < 0)
+        return -1;
+
+    res->data = data;
+    res->len = (size_t) len;
+
+    return 0;
 }
 
 char *oid_to_string(const oid_t *oid) {
-    size_t i;
-    char res[100];
+    size_t i, size = 12 * (oid->len + 1);
+    char *res = malloc(size);
     char *res_tmp = res;
+    uint32_t subid = 0;
+
+    if (NULL == res) return NULL;
+    *res = '\0';
 
-    for (i = 0; i < oid->subids_cnt; i++) {
-        res_tmp += snprintf(res_tmp, (sizeof(res) - (res_tmp - res) * sizeof(*res)), ".%d", oid->subids[i]);
+    for (i = 0; i < oid->len; i++) {
+        subid = (subid << 7) | (oid->data[i] & 0x7F);
+        if (oid->data[i] & 0x80) continue;
+
+        // first two arcs share the same subidentifier
+        if (res_tmp == res) {
+            res_tmp += snprintf(res_tmp, size, ".%u.%u", subid < 80 ? subid / 40 : 2, subid < 80 ? subid % 40 : subid - 80);
+        } else {
+            res_tmp += snprintf(res_tmp, size - (res_tmp - res), ".%u", subid);
+        }
+
+        subid = 0;
+    }
+
+    return res;
+}
+
+int string_to_type(const char *val, object_type_t *res) {
+    if (NULL == val) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (0 == strcmp(val, "INTEGER")) {
+        *res = OBJECT_TYPE_INTEGER;
+    } else if (0 == strcmp(val, "STRING")) {
+        *res = OBJECT_TYPE_OCTET_STRING;
+    } else if (0 == strcmp(val, "OID")) {
+        *res = OBJECT_TYPE_OID;
+    } else if (0 == strcmp(val, "COUNTER")) {
+        *res = OBJECT_TYPE_COUNTER;
+    } else if (0 == strcmp(val, "GAUGE")) {
+        *res = OBJECT_TYPE_GAUGE;
+    } else if (0 == strcmp(val, "TIMETICKS")) {
+        *res = OBJECT_TYPE_TIMETICKS;
+    } else if (0 == strcmp(val, "COUNTER64")) {
+        *res = OBJECT_TYPE_COUNTER64;
+    } else {
+        errno = EINVAL;
+        return -1;
     }
 
-    return strdup(res);
+    return 0;
 }
@@ -23,7 +23,11 @@
 
 void print_asn1_tree(const asn1_node_t *root, size_t spaces, const char *prefix);
 
-void string_to_oid(const char *val, oid_t *res);
+// encoded OID is allocated in arena
+int string_to_oid(arena_t *arena, const char *val, oid_t *res);
 char *oid_to_string(const oid_t *oid);
 
+// type of value handled by getters: INTEGER, STRING, OID, COUNTER, GAUGE, TIMETICKS or COUNTER64
+int string_to_type(const char *val, object_type_t *res);
+
 #endif //SNMP_UTILITIES_H